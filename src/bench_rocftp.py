@@ -0,0 +1,99 @@
+"""
+Compares the sweeps per sample of the two algorithms of ./rasm:
+coupling from the past doubling the number of steps (-algorithm doubling)
+and read-once coupling from the past (-algorithm rocftp).
+
+A sweep is one update of every site of a single height function, so a
+step of doubling (min and max) is 2 sweeps and a block of rocftp is 2 or 3
+sweeps per step (min and max, and the chain being followed).
+The block of rocftp is the median number of steps doubling coalesced
+after, times -factor.
+
+-h for help
+
+Example usage:
+
+    :: orders 50 and 100, 20 samples each ::
+
+    $ python3 bench_rocftp.py -samples 20 50 100
+
+(C) Dan Betea 2017--2023
+
+License: MIT License
+"""
+
+import subprocess, os, sys, re, statistics
+
+RASM = os.path.join(os.path.dirname(os.path.abspath(__file__)), "rasm")
+
+
+def run_rasm(args):
+    """
+    Runs ./rasm with args, discarding the samples, and returns its
+    standard error (where the steps and sweeps are reported).
+    """
+    result = subprocess.run([RASM] + [str(a) for a in args] + ["-height"],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE,
+                            universal_newlines=True, check=True)
+    return result.stderr
+
+
+def doubling(order, samples):
+    """
+    Returns the lists of steps and sweeps of doubling for seeds 1, ..., samples.
+    """
+    steps, sweeps = [], []
+    for seed in range(1, samples + 1):
+        err = run_rasm([order, "-seed", seed])
+        steps.append(int(re.search(r"generated after (\d+) steps", err).group(1)))
+        sweeps.append(int(re.search(r"Sweeps of a height function: (\d+)", err).group(1)))
+    return steps, sweeps
+
+
+def rocftp(order, samples, block):
+    """
+    Returns the total sweeps of rocftp for samples samples from one chain.
+    """
+    err = run_rasm([order, "-algorithm", "rocftp", "-block", block,
+                    "-count", samples, "-seed", 1])
+    return int(re.search(r"Sweeps of a height function: (\d+)", err).group(1))
+
+
+def usage():
+    print("Usage: python3 bench_rocftp.py [-samples N] [-factor F] [order ...]")
+    print("  default: 10 samples, factor 1, orders 50 100 200 300 400 500")
+    sys.exit(1)
+
+
+if __name__ == "__main__":
+    # options the ./rasm way, -samples rather than --samples
+    argv = sys.argv[1:]
+    samples, factor, orders = 10, 1.0, []
+    i = 0
+    while i < len(argv):
+        if argv[i] in ("-h", "-help", "--help"):
+            usage()
+        elif argv[i] in ("-samples", "--samples") and i + 1 < len(argv):
+            samples = int(argv[i + 1])
+            i += 1
+        elif argv[i] in ("-factor", "--factor") and i + 1 < len(argv):
+            factor = float(argv[i + 1])
+            i += 1
+        else:
+            orders.append(int(argv[i]))
+        i += 1
+    if not orders:
+        orders = [50, 100, 200, 300, 400, 500]
+    if not os.path.exists(RASM):
+        subprocess.run(["make", "-C", os.path.dirname(RASM), "rasm"], check=True)
+
+    print("%6s %8s %14s %8s %14s %7s" % ("order", "median", "doubling", "block",
+                                         "rocftp", "ratio"))
+    for order in orders:
+        steps, sweeps = doubling(order, samples)
+        block = max(1, int(statistics.median(steps) * factor))
+        per_doubling = sum(sweeps) / samples
+        per_rocftp = rocftp(order, samples, block) / samples
+        print("%6d %8d %14.0f %8d %14.0f %7.2f" % (order, statistics.median(steps),
+              per_doubling, block, per_rocftp, per_rocftp / per_doubling))
+        sys.stdout.flush()
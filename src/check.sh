@@ -0,0 +1,96 @@
+#!/bin/sh
+# Checks that the ways of running ./rasm that are meant to give the same
+# sample for a given -seed do: the scalar and AVX2 kernels at every
+# -width, the pair and separate -layout with every kernel and width,
+# rasm_omp at 1 and 4 threads, a run killed and then resumed from its
+# checkpoint, -processes 1, 2 and 3, and -tile 1, 3 and 8. Compares the
+# -height outputs and exits with 1 if any differ. Run by `make check`.
+#
+# (C) Dan Betea 2017--2023
+#
+# License: MIT License
+
+cd "$(dirname "$0")" || exit 1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+failed=0
+
+# same <description> <reference args> <args>: the -height of both agree
+same() {
+    description=$1
+    ./rasm $2 -height > "$tmp/expected" 2>/dev/null || { echo "FAIL $description: ./rasm $2"; failed=1; return; }
+    eval "$3" > "$tmp/got" 2>/dev/null || { echo "FAIL $description: $3"; failed=1; return; }
+    if cmp -s "$tmp/expected" "$tmp/got"; then
+        echo "ok   $description"
+    else
+        echo "FAIL $description: differs from ./rasm $2"
+        failed=1
+    fi
+}
+
+# the kernels, at every width (a width too narrow for the order is widened)
+kernels=scalar
+if ./rasm 7 -kernel avx2 > /dev/null 2>&1; then
+    kernels="scalar avx2"
+    for order in 7 30 61 200; do
+        seeds="1 2 3"
+        [ $order -ge 200 ] && seeds=1
+        for seed in $seeds; do
+            for width in 8 16 32; do
+                same "kernels order $order seed $seed width $width" \
+                     "$order -seed $seed -width $width -kernel scalar" \
+                     "./rasm $order -seed $seed -width $width -kernel avx2 -height"
+            done
+        done
+    done
+else
+    echo "skip kernels: no AVX2 on this CPU"
+fi
+
+# the min and max side by side, with every kernel and width (order 150
+# seed 3 has a chain meet the previous run, and unpacks at the snapshots)
+for kernel in $kernels; do
+    for order in 7 30 61; do
+        for seed in 1 2; do
+            for width in 8 16 32; do
+                same "pair layout $kernel order $order seed $seed width $width" \
+                     "$order -seed $seed -width $width -kernel $kernel -layout separate" \
+                     "./rasm $order -seed $seed -width $width -kernel $kernel -layout pair -height"
+            done
+        done
+    done
+    for width in 16 32; do
+        same "pair layout $kernel order 150 seed 3 width $width" \
+             "150 -seed 3 -width $width -kernel $kernel -layout separate" \
+             "./rasm 150 -seed 3 -width $width -kernel $kernel -layout pair -height"
+    done
+done
+
+# OpenMP threads
+for threads in 1 4; do
+    same "rasm_omp $threads threads" "100 -seed 7" \
+         "OMP_NUM_THREADS=$threads ./rasm_omp 100 -seed 7 -height"
+done
+
+# killed while checkpointing every sweep, then resumed
+rm -f "$tmp/ckpt"
+timeout -s KILL 0.3 ./rasm 100 -seed 6 -height -checkpoint "$tmp/ckpt" \
+    -checkpoint_every 0 > /dev/null 2>&1
+same "killed and resumed" "100 -seed 6" "./rasm 100 -height -resume $tmp/ckpt"
+
+# strips of rows in worker processes
+for processes in 1 2 3; do
+    same "processes $processes" "61 -seed 4" \
+         "./rasm 61 -seed 4 -processes $processes -height"
+done
+
+# sweeps run together as a wavefront
+for tile in 1 3 8; do
+    same "tile $tile" "100 -seed 5" "./rasm 100 -seed 5 -tile $tile -height"
+done
+
+if [ $failed -ne 0 ]; then
+    echo "Some checks failed"
+    exit 1
+fi
+echo "All checks passed"
@@ -5,12 +5,20 @@
 #include <climits>
 #include <cstdio>
 #include <cstring>
+#include <cstdint>
 #include <random>
 #include <cmath>
+#include <vector>
+#include <functional>
+#include <string>
+#include <map>
+#include <chrono>
+#include <exception>
+#include <fcntl.h>
 #include "rasm.h"
 
-extern int offset;
-
+// the benchmarks (rasm_bench.cpp) link the output functions below without main
+#ifndef RASM_NO_MAIN
 int main(int argc, char **argv) {
     /*
     -----------------
@@ -21,12 +29,27 @@ int main(int argc, char **argv) {
     int order, n_rows, n_cols; // order/size of ASM, num rows and num cols
     int count; 
     // const options for command line arguments for displaying ASM
-    enum cmd_options {ASM = 2, HEIGHT = 3, CSUM = 4, ASM_F = 5};
+    enum cmd_options {ASM = 2, HEIGHT = 3, CSUM = 4, ASM_F = 5, STATS = 6};
     int output = ASM; // default option for printing to stdout
     // various options for command line
-    bool min_only = false, max_only = false, use_random = true, report = false;
+    bool min_only = false, max_only = false, use_random = true;
+    int report = 0; // 1 for -report, 2 for -report_sweeps
     int seeds[256]; // seeds for coupling from the past
     int initial = 128, random_seed; // initial no. of steps to try, random seed
+    int width = 0; // bytes per height entry, 0 for the narrowest that fits
+    bool width_set = false; // -width other than auto
+    int n_samples = 1, threads = 0; // batch size, threads (0 for one per core)
+    bool binary = false; // -format bin, see write_bin
+    bool auto_initial = false; // -initial auto: learn it, see learned_initial
+    const char *checkpoint_file = NULL, *resume_file = NULL;
+    double checkpoint_every = 600; // seconds between checkpoints
+    const char *telemetry_to = NULL; // -telemetry: a file descriptor or file
+    double telemetry_every = 10; // seconds between progress lines
+    bool rocftp = false; // -algorithm rocftp, see Rocftp
+    int block = 0; // steps per block of rocftp, 0 for the initial value
+    int processes = 0; // -processes: workers of run_cftp_strips, 0 for none
+    const char *trajectory_file = NULL; // -trajectory, see Trajectory
+    int trajectory_sweeps = 64; // the last sweeps it has
 
 
     /*
@@ -57,15 +80,6 @@ int main(int argc, char **argv) {
     n_rows = order + 1;
     n_cols = order + 1; 
 
-    // declare the min and max height functions
-    // allocate memory
-    int **minimum_ht = new int*[n_rows];
-    int **maximum_ht = new int*[n_rows];
-    for(int i=0; i<n_rows; ++i) {
-        minimum_ht[i] = new int[n_cols];
-        maximum_ht[i] = new int[n_cols];
-    }
-
     if(argc > 2)
         for(count=2; count<argc; ++count) {
             if (!strcmp(argv[count],"-asm"))
@@ -76,8 +90,12 @@ int main(int argc, char **argv) {
                 output = CSUM;
             else if(!strcmp(argv[count], "-height"))
                 output = HEIGHT;
+            else if(!strcmp(argv[count], "-stats"))
+                output = STATS;
             else if (!strcmp(argv[count],"-report"))
-                report = true;
+                report = std::max(report, 1);
+            else if (!strcmp(argv[count],"-report_sweeps"))
+                report = 2;
             else if (!strcmp(argv[count],"-min_only"))
                 min_only = true;
             else if (!strcmp(argv[count],"-max_only"))
@@ -97,6 +115,12 @@ int main(int argc, char **argv) {
                     std::cerr << "You must specify an initial number of steps.\n";
                     exit(1);
                 }
+                if(!strcmp(argv[count+1], "auto")) {
+                    auto_initial = true;
+                    ++count;
+                    continue;
+                }
+                auto_initial = false;
                 initial = std::stoi(argv[count+1]);
                 if (initial < 1 || initial > 536870912) {
                     std::cerr << "Invalid value for initial; it must be between 1 and 2^29 = 536870912 \n";
@@ -109,6 +133,213 @@ int main(int argc, char **argv) {
                               << initial << std::endl;
                 }
             }
+            else if(!strcmp(argv[count],"-kernel")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a kernel.\n";
+                    exit(1);
+                }
+                if(!set_evolve_kernel(argv[count+1])) {
+                    std::cerr << "Invalid or unsupported kernel " << argv[count+1]
+                              << "; it must be one of scalar, avx2, auto\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-layout")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a layout.\n";
+                    exit(1);
+                }
+                if(!set_evolve_layout(argv[count+1])) {
+                    std::cerr << "Invalid layout " << argv[count+1]
+                              << "; it must be one of separate, pair\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-tile")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of sweeps per tile.\n";
+                    exit(1);
+                }
+                if(!strcmp(argv[count+1], "auto"))
+                    set_evolve_tile(0);
+                else {
+                    const int sweeps = std::stoi(argv[count+1]);
+                    if(sweeps < 1) {
+                        std::cerr << "Invalid number of sweeps per tile; it must be at least 1\n";
+                        exit(1);
+                    }
+                    set_evolve_tile(sweeps);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-width")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a width.\n";
+                    exit(1);
+                }
+                if(!strcmp(argv[count+1], "auto"))
+                    width = 0;
+                else if(!strcmp(argv[count+1], "8"))
+                    width = 1;
+                else if(!strcmp(argv[count+1], "16"))
+                    width = 2;
+                else if(!strcmp(argv[count+1], "32"))
+                    width = 4;
+                else {
+                    std::cerr << "Invalid width " << argv[count+1]
+                              << "; it must be one of 8, 16, 32, auto\n";
+                    exit(1);
+                }
+                width_set = width != 0;
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-format")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a format.\n";
+                    exit(1);
+                }
+                if(!strcmp(argv[count+1], "text"))
+                    binary = false;
+                else if(!strcmp(argv[count+1], "bin"))
+                    binary = true;
+                else {
+                    std::cerr << "Invalid format " << argv[count+1]
+                              << "; it must be one of text, bin\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-checkpoint")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a checkpoint file.\n";
+                    exit(1);
+                }
+                checkpoint_file = argv[++count];
+            }
+            else if(!strcmp(argv[count],"-checkpoint_every")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of seconds.\n";
+                    exit(1);
+                }
+                checkpoint_every = std::stod(argv[count+1]);
+                if(checkpoint_every < 0) {
+                    std::cerr << "Invalid number of seconds between checkpoints\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-telemetry")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a file descriptor or file for the telemetry.\n";
+                    exit(1);
+                }
+                telemetry_to = argv[++count];
+            }
+            else if(!strcmp(argv[count],"-telemetry_every")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of seconds.\n";
+                    exit(1);
+                }
+                telemetry_every = std::stod(argv[count+1]);
+                if(telemetry_every < 0) {
+                    std::cerr << "Invalid number of seconds between telemetry lines\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-trajectory")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a file for the trajectory.\n";
+                    exit(1);
+                }
+                trajectory_file = argv[++count];
+            }
+            else if(!strcmp(argv[count],"-trajectory_sweeps")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of sweeps.\n";
+                    exit(1);
+                }
+                trajectory_sweeps = std::stoi(argv[count+1]);
+                if(trajectory_sweeps < 1) {
+                    std::cerr << "Invalid number of sweeps of the trajectory; it must be at least 1\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-resume")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a checkpoint file to resume from.\n";
+                    exit(1);
+                }
+                resume_file = argv[++count];
+            }
+            else if(!strcmp(argv[count],"-count")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of samples.\n";
+                    exit(1);
+                }
+                n_samples = std::stoi(argv[count+1]);
+                if(n_samples < 1) {
+                    std::cerr << "Invalid number of samples; it must be at least 1\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-threads")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of threads.\n";
+                    exit(1);
+                }
+                threads = std::stoi(argv[count+1]);
+                if(threads < 1) {
+                    std::cerr << "Invalid number of threads; it must be at least 1\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-algorithm")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify an algorithm.\n";
+                    exit(1);
+                }
+                if(!strcmp(argv[count+1], "doubling"))
+                    rocftp = false;
+                else if(!strcmp(argv[count+1], "rocftp"))
+                    rocftp = true;
+                else {
+                    std::cerr << "Invalid algorithm " << argv[count+1]
+                              << "; it must be doubling or rocftp\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-block")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of steps per block.\n";
+                    exit(1);
+                }
+                block = std::stoi(argv[count+1]);
+                if(block < 1) {
+                    std::cerr << "Invalid block; it must be at least 1\n";
+                    exit(1);
+                }
+                ++count;
+            }
+            else if(!strcmp(argv[count],"-processes")) {
+                if(count == argc - 1) {
+                    std::cerr << "You must specify a number of processes.\n";
+                    exit(1);
+                }
+                processes = std::stoi(argv[count+1]);
+                if(processes < 1 || 2 * processes > n_rows) {
+                    std::cerr << "Invalid number of processes; it must be between 1 and "
+                              << n_rows / 2 << " (two rows each)\n";
+                    exit(1);
+                }
+                ++count;
+            }
             else if(!strcmp(argv[count],"-help"))
                 print_options();
             else {
@@ -117,26 +348,77 @@ int main(int argc, char **argv) {
             }
         }
 
+    // the binary format has the ASM and the height function, the corner
+    // sums are easily computed from the latter
+    if(binary && output == CSUM) {
+        std::cerr << "-csum can't be used with -format bin, use -height\n";
+        exit(1);
+    }
+    if(binary && output == STATS) {
+        std::cerr << "-stats can't be used with -format bin\n";
+        exit(1);
+    }
+    const int kind = output == HEIGHT ? BIN_HEIGHT : BIN_ASM;
+
+    // with -initial auto, start from what past runs of this order needed
+    const std::string cache = initial_cache_path(argv[0]);
+    if(auto_initial) {
+        int learned = learned_initial(cache.c_str(), order);
+        if(learned > 0)
+            initial = learned;
+        if(report)
+            std::cerr << "Using initial " << initial
+                      << (learned > 0 ? " learned from " : " (nothing learned yet in ")
+                      << cache << (learned > 0 ? ".\n" : ").\n");
+    }
+
+    // wall and CPU time of each phase, given with -report
+    PhaseTimer timer;
+    timer.enter(PhaseTimer::INITIALIZATION);
+
+    // declare the min and max height functions; heights go up to n_rows
+    if(width == 0 || width < ht_width(n_rows))
+        width = ht_width(n_rows);
+    HeightField minimum_ht(n_rows, n_cols, width);
+    HeightField maximum_ht(n_rows, n_cols, width);
+
     // initialize min and max height functions
-    initialize_ht(minimum_ht, maximum_ht, n_rows, n_cols);
+    initialize_ht(minimum_ht, maximum_ht);
+
+    // -stats: the mean and standard deviation of these over the samples
+    Accumulator stats({asm_entries_observable(maximum_ht),
+                       row_minus_ones_observable(maximum_ht),
+                       height_histogram_observable(maximum_ht)});
 
     // print min or max ht function if so desired
+    if((min_only || max_only) && binary) {
+        write_bin(stdout, min_only ? minimum_ht : maximum_ht, kind, 0, 0, 0);
+        exit(0);
+    }
     if (min_only) {
         if(output == ASM)
-            print_asm(minimum_ht, n_rows, n_cols);
+            print_asm(minimum_ht);
         else if(output == CSUM)
-            print_csum(minimum_ht, n_rows, n_cols);
+            print_csum(minimum_ht);
+        else if(output == STATS) {
+            stats.add(minimum_ht);
+            print_stats(stdout, stats);
+        }
         else
-            print_ht(minimum_ht, n_rows, n_cols);
+            print_ht(minimum_ht);
         exit(0);
     }
     else if(max_only) {
         if(output == ASM)
-            print_asm(maximum_ht, n_rows, n_cols);
+            print_asm(maximum_ht);
         else if(output == CSUM)
-            print_csum(maximum_ht, n_rows, n_cols);
+            print_csum(maximum_ht);
+        else if(output == STATS) {
+            stats.add(maximum_ht);
+            print_stats(stdout, stats);
+        }
         else
-            print_ht(maximum_ht, n_rows, n_cols);
+            print_ht(maximum_ht);
         exit(0);
     }
 
@@ -148,6 +430,32 @@ int main(int argc, char **argv) {
     */
     
 
+    // carry on from a checkpoint: its seeds and height functions, and it
+    // goes on being checkpointed to, unless -checkpoint says otherwise
+    CftpProgress progress;
+    if(resume_file != NULL) {
+        if(n_samples > 1) {
+            std::cerr << "-resume can't be used with -count\n";
+            exit(1);
+        }
+        if(!load_checkpoint(resume_file, random_seed, seeds, progress,
+                            minimum_ht, maximum_ht)) {
+            std::cerr << "No complete checkpoint in " << resume_file << std::endl;
+            exit(1);
+        }
+        if(minimum_ht.n_rows() != n_rows || minimum_ht.n_cols() != n_cols) {
+            std::cerr << "The checkpoint in " << resume_file << " is of order "
+                      << minimum_ht.n_rows() - 1 << ", not " << order << std::endl;
+            exit(1);
+        }
+        width = minimum_ht.width();
+        use_random = false;
+        if(checkpoint_file == NULL)
+            checkpoint_file = resume_file;
+        std::cerr << "Resuming at step " << progress.step << " of "
+                  << progress.time_steps << ".\n";
+    }
+
     // create a random seed to be used just below
     if (use_random) {
         // std::cerr << "\nGenerating random seed to start everything..." 
@@ -159,19 +467,191 @@ int main(int argc, char **argv) {
     }
 
     std::cerr << "Using random seed " << random_seed << ".\n";
+    if(report)
+        std::cerr << "Using the " << evolve_kernel_name() << " kernel with "
+                  << 8 * width << "-bit heights (" << evolve_layout_name()
+                  << " layout).\n";
+
+    // -processes only runs the doubling of a single sample
+    if(processes > 0 && (rocftp || n_samples > 1 || checkpoint_file != NULL ||
+                         resume_file != NULL || telemetry_to != NULL ||
+                         trajectory_file != NULL)) {
+        std::cerr << "-processes can't be used with -count, -algorithm rocftp, "
+                     "-checkpoint, -resume, -telemetry or -trajectory\n";
+        exit(1);
+    }
+    // the trajectory is that of the run of a single sample that coalesced
+    if(trajectory_file != NULL && (rocftp || n_samples > 1)) {
+        std::cerr << "-trajectory can't be used with -count or -algorithm rocftp\n";
+        exit(1);
+    }
+
+    // read-once coupling from the past: one chain gives the samples one
+    // after the other, each printed as soon as it is done (after a line with
+    // its index and the sweeps it took, when there are several)
+    if(rocftp) {
+        if(checkpoint_file != NULL || resume_file != NULL || telemetry_to != NULL) {
+            std::cerr << "-checkpoint, -resume and -telemetry can't be used with -algorithm rocftp\n";
+            exit(1);
+        }
+        if(output == ASM_F && n_samples > 1) {
+            std::cerr << "-asm_file writes a single ASM, it can't be used with -count\n";
+            exit(1);
+        }
+        if(block == 0)
+            block = initial;
+        Rocftp chain(order, random_seed, block, width, report);
+        HeightField sample;
+        long long total_sweeps = 0;
+        for(int index=0; index<n_samples; ++index) {
+            timer.enter(PhaseTimer::SAMPLING);
+            const long long sweeps = chain.next(sample);
+            total_sweeps += sweeps;
+            timer.enter(PhaseTimer::OUTPUT);
+            if(output == STATS) {
+                stats.add(sample);
+                continue;
+            }
+            if(binary) {
+                std::FILE *out = output == ASM_F ? std::fopen("asm.bin", "wb") : stdout;
+                if(out == NULL) {
+                    std::cerr << "File error!";
+                    std::exit(1);
+                }
+                write_bin(out, sample, kind, index, random_seed, sweeps);
+                if(out != stdout)
+                    std::fclose(out);
+            }
+            else {
+                if(n_samples > 1)
+                    std::printf("# sample %d sweeps %lld\n", index, sweeps);
+                if(output == ASM)
+                    print_asm(sample);
+                else if(output == ASM_F)
+                    print_asm_to_file(sample);
+                else if(output == CSUM)
+                    print_csum(sample);
+                else
+                    print_ht(sample);
+            }
+            std::fflush(stdout);
+        }
+        if(output == STATS)
+            print_stats(stdout, stats);
+        std::cerr << "Random ASM" << (n_samples > 1 ? "s" : "") << " of order "
+                  << order << " x " << order << " generated with blocks of "
+                  << block << " steps." << std::endl;
+        std::cerr << "Sweeps of a height function: " << total_sweeps << " ("
+                  << (double) total_sweeps / n_samples << " per sample)." << std::endl;
+        timer.stop();
+        std::fprintf(stderr, "Elapsed time: %.4f seconds (wall), %.4f seconds of CPU.\n",
+                     timer.wall(), timer.cpu());
+        if(report)
+            print_timings(timer);
+        return 0;
+    }
 
-    // initialize the random number generator used throughout
-    // note: as soon as the main loop starts running, it will be reinitialized
-    // this initialization is then only used to generate 256 random seeds used
-    // in the coupling from the past construction down the line
-    std::mt19937 rn_gen(random_seed);
-    offset = 32; // technically not needed here
-
-    // get 256 seeds, to be used by the random number generator in the
-    // coupling from the past main loop
-    for (count = 0; count < 256; ++count) {
-        std::uniform_int_distribution<> dist(-INT_MAX-1, INT_MAX);
-        seeds[count] = dist(rn_gen);
+    // a batch: each sample is printed as soon as it is done, after a line
+    // with its index and the seed that samples it on its own (in binary,
+    // these are in the header of its record); with -stats, only the
+    // statistics of all of them are, at the end
+    if(n_samples > 1) {
+        if(output == ASM_F) {
+            std::cerr << "-asm_file writes a single ASM, it can't be used with -count\n";
+            exit(1);
+        }
+        if(checkpoint_file != NULL || telemetry_to != NULL) {
+            std::cerr << "-checkpoint and -telemetry can't be used with -count\n";
+            exit(1);
+        }
+        // the samplers of the threads use the narrowest width that fits
+        if(width_set) {
+            std::cerr << "-width can't be used with -count\n";
+            exit(1);
+        }
+        std::map<int, int> coalescence; // number of samples by steps
+        if(output == STATS) {
+            // only the statistics, added up by the threads as they go
+            sample_asm_batch(order, n_samples, initial, random_seed, threads, stats,
+                [&](const int index, const int, const int steps,
+                    const HeightField &) {
+                    ++coalescence[steps];
+                    if(report)
+                        std::cerr << "Sample " << index << " done.\n";
+                });
+            print_stats(stdout, stats);
+        }
+        else {
+            sample_asm_batch(order, n_samples, initial, random_seed, threads,
+                [&](const int index, const int sample_seed, const int steps,
+                    const HeightField &ht) {
+                    ++coalescence[steps];
+                    if(binary)
+                        write_bin(stdout, ht, kind, index, sample_seed, steps);
+                    else {
+                        std::printf("# sample %d seed %d\n", index, sample_seed);
+                        if(output == ASM)
+                            print_asm(ht);
+                        else if(output == CSUM)
+                            print_csum(ht);
+                        else
+                            print_ht(ht);
+                    }
+                    std::fflush(stdout);
+                    if(report)
+                        std::cerr << "Sample " << index << " done.\n";
+                });
+        }
+        if(auto_initial)
+            for(const auto &entry : coalescence)
+                record_coalescence(cache.c_str(), order, entry.first, entry.second,
+                                   initial);
+        return 0;
+    }
+
+    // get the seeds used in the coupling from the past main loop
+    if(resume_file == NULL)
+        cftp_seeds(random_seed, seeds);
+
+    // telemetry to a file descriptor (e.g. -telemetry 3 with 3>file) or a
+    // file, appended to
+    Telemetry *telemetry = NULL;
+    if(telemetry_to != NULL) {
+        int fd;
+        if(std::strspn(telemetry_to, "0123456789") == std::strlen(telemetry_to))
+            fd = std::stoi(telemetry_to);
+        else
+            fd = open(telemetry_to, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(fd < 0 || fcntl(fd, F_GETFD) < 0) {
+            std::cerr << "Can't write the telemetry to " << telemetry_to << std::endl;
+            exit(1);
+        }
+        telemetry = new Telemetry(fd, telemetry_every);
+    }
+
+    // the -1 entries and the diagonal corner sums over the last sweeps
+    Trajectory *trajectory = NULL;
+    std::FILE *trajectory_out = NULL;
+    if(trajectory_file != NULL) {
+        trajectory_out = std::fopen(trajectory_file, "w");
+        if(trajectory_out == NULL) {
+            std::cerr << "Can't write the trajectory to " << trajectory_file << std::endl;
+            exit(1);
+        }
+        trajectory = new Trajectory(trajectory_sweeps,
+            {minus_ones_observable(), csum_diagonal_observable(maximum_ht)});
+    }
+
+    Checkpoint *checkpoint = NULL;
+    if(checkpoint_file != NULL) {
+        try {
+            checkpoint = new Checkpoint(checkpoint_file, maximum_ht, random_seed,
+                                        checkpoint_every);
+        }
+        catch(const std::exception &error) {
+            std::cerr << error.what() << std::endl;
+            exit(1);
+        }
     }
 
 
@@ -182,8 +662,32 @@ int main(int argc, char **argv) {
     */
 
 
-    run_cftp(minimum_ht, maximum_ht, n_rows, n_cols,
-             rn_gen, seeds, initial, report, true);
+    int steps;
+    if(processes > 0) {
+        // strips of rows in worker processes, the same sample
+        try {
+            steps = run_cftp_strips(minimum_ht, maximum_ht, seeds, initial,
+                                    report, true, processes, &timer);
+        }
+        catch(const std::exception &error) {
+            std::cerr << error.what() << std::endl;
+            exit(1);
+        }
+    }
+    else
+        steps = run_cftp(minimum_ht, maximum_ht, seeds, initial, report, true,
+                         checkpoint, resume_file != NULL ? &progress : NULL,
+                         telemetry, &timer, trajectory);
+    delete checkpoint;
+    delete telemetry;
+    if(trajectory != NULL) {
+        timer.enter(PhaseTimer::OUTPUT);
+        print_trajectory(trajectory_out, *trajectory);
+        std::fclose(trajectory_out);
+        delete trajectory;
+    }
+    if(auto_initial && !record_coalescence(cache.c_str(), order, steps, 1, initial))
+        std::cerr << "Warning, could not write " << cache << std::endl;
 
 
     /*
@@ -193,27 +697,50 @@ int main(int argc, char **argv) {
     */
 
 
-    if(output == ASM) 
-        print_asm(maximum_ht, n_rows, n_cols);
+    timer.enter(PhaseTimer::OUTPUT);
+    if(binary && output == ASM_F) {
+        std::FILE *fptr = std::fopen("asm.bin", "wb");
+        if(fptr == NULL) {
+            std::cerr << "File error!";
+            std::exit(1);
+        }
+        write_bin(fptr, maximum_ht, kind, 0, random_seed, steps);
+        std::fclose(fptr);
+    }
+    else if(binary)
+        write_bin(stdout, maximum_ht, kind, 0, random_seed, steps);
+    else if(output == ASM) 
+        print_asm(maximum_ht);
     else if(output == ASM_F)
-        print_asm_to_file(maximum_ht, n_rows, n_cols);
+        print_asm_to_file(maximum_ht);
     else if(output == CSUM)
-        print_csum(maximum_ht, n_rows, n_cols);
+        print_csum(maximum_ht);
+    else if(output == STATS) {
+        stats.add(maximum_ht);
+        print_stats(stdout, stats);
+    }
     else
-        print_ht(maximum_ht, n_rows, n_cols);
+        print_ht(maximum_ht);
+    std::fflush(stdout);
+    timer.stop();
+    if(report)
+        print_timings(timer);
 
     // std::cerr<<std::endl;
 
-    // deallocate memory
-    for(int i=0; i<n_rows; ++i) {
-        delete [] minimum_ht[i];
-        delete [] maximum_ht[i];
-    }
-    delete [] minimum_ht;
-    delete [] maximum_ht;
-
     return 0;
 }
+#endif
+
+void print_timings(const PhaseTimer &timer) {
+    std::fprintf(stderr, "Time by phase (wall / CPU seconds):\n");
+    for(int phase=0; phase<PhaseTimer::N_PHASES; ++phase)
+        std::fprintf(stderr, "  %-15s %10.4f / %.4f\n",
+                     PhaseTimer::name((PhaseTimer::Phase) phase),
+                     timer.wall((PhaseTimer::Phase) phase),
+                     timer.cpu((PhaseTimer::Phase) phase));
+    std::fprintf(stderr, "  %-15s %10.4f / %.4f\n", "total", timer.wall(), timer.cpu());
+}
 
 void print_options() {
     std::cout << std::endl;
@@ -227,9 +754,39 @@ void print_options() {
     std::cout << "   -asm_file         output the alternating sign matrix to files asm.txt and asm_pretty.txt\n";
     std::cout << "   -csum             output the corresponding corner sum matrix\n";
     std::cout << "   -height           output the corresponding height function\n";
+    std::cout << "   -stats            output only the mean and standard deviation over the samples (see -count) of\n";
+    std::cout << "                     the ASM entries, the -1 entries of each row and the number of sites of each height\n";
     std::cout << "   -seed <value>     use a specific random seed\n";
     std::cout << "   -initial <value>  use a specific initial value\n";
+    std::cout << "   -initial auto     learn the initial value from past runs of the same order, cached in\n";
+    std::cout << "                     rasm_initial.txt in $RASM_CACHE_DIR (default, next to the program)\n";
     std::cout << "   -report           give a progress report\n";
+    std::cout << "   -report_sweeps    give a progress report, with the volume after every sweep\n";
+    std::cout << "   -kernel <name>    sweep kernel: scalar, avx2 or auto (default, best the CPU supports)\n";
+    std::cout << "   -tile <sweeps>    sweeps run together down the rows, staying in cache (same output): a number\n";
+    std::cout << "                     or auto (default, 8 if the min and max don't fit in the L2 cache, else 1)\n";
+    std::cout << "   -layout <name>    min and max swept as two height functions (separate, the default) or side\n";
+    std::cout << "                     by side, a sweep at a time (pair, same output; not with -telemetry or -trajectory)\n";
+    std::cout << "   -width <bits>     bits per height entry: 8, 16, 32 or auto (default, narrowest that fits)\n";
+    std::cout << "                     (not with a -count batch, whose samplers always use the narrowest)\n";
+    std::cout << "   -format <name>    text (default) or bin, a compact binary record per sample (-asm_file writes asm.bin)\n";
+    std::cout << "   -checkpoint <file> save the state to file every so often (see -checkpoint_every), and when done\n";
+    std::cout << "   -checkpoint_every <seconds>  time between checkpoints (default 600)\n";
+    std::cout << "   -telemetry <fd|file>  write JSON lines on the progress to a file descriptor (e.g. 3 with 3>file)\n";
+    std::cout << "                     or a file (appended to): one per epoch and run, and a progress line\n";
+    std::cout << "   -telemetry_every <seconds>  time between progress lines (default 10, 0 for every sweep)\n";
+    std::cout << "   -trajectory <file> write the number of -1 entries and the corner sums on the diagonal after\n";
+    std::cout << "                     each of the last sweeps (the same coins: exact samples where the volume is 0)\n";
+    std::cout << "   -trajectory_sweeps <value>  the number of last sweeps of the trajectory (default 64)\n";
+    std::cout << "   -resume <file>    carry on from the last checkpoint in file (and keep checkpointing to it)\n";
+    std::cout << "   -count <value>    sample this many independent ASMs, each printed after a '# sample' line\n";
+    std::cout << "   -threads <value>  number of threads sampling a -count batch (default, one per core)\n";
+    std::cout << "   -algorithm <name> doubling (default, coupling from the past doubling the steps from -initial)\n";
+    std::cout << "                     or rocftp (read-once: one chain run forward in blocks, -count samples in turn)\n";
+    std::cout << "   -block <value>    steps per block of rocftp (default, the initial value), best about\n";
+    std::cout << "                     the usual coalescence time\n";
+    std::cout << "   -processes <value> split the rows into strips, each swept by a worker process of its own\n";
+    std::cout << "                     (same sample as without; not with -count or -algorithm rocftp)\n";
     std::cout << "   -min_only         only output the minimum square ice\n";
     std::cout << "   -max_only         only output the maximum square ice\n";
     std::cout << "   -help             give a listing of command line arguments\n";
@@ -241,43 +798,88 @@ void print_options() {
     std::exit(1);
 }
 
-void print_ht(int **matrix_ht, const int n_rows, const int n_cols) {
+void print_ht(const HeightField &matrix_ht) {
+    const int n_rows = matrix_ht.n_rows(), n_cols = matrix_ht.n_cols();
     int row, col;
     // the max entry and its number of digits (formatting purposes)
     int max_entry = (int) (std::max(n_rows, n_cols));
     int num_digits = ((int) std::floor(std::log10(max_entry)))+1;
     for (row = 0; row < n_rows; ++row) {
         for (col = 0; col < n_cols; ++col)
-            std::printf("%*d ", num_digits, matrix_ht[row][col]);
+            std::printf("%*d ", num_digits, matrix_ht.get(row, col));
         std::printf("\n");
     }
 }
 
-void print_csum(int **matrix_ht, const int n_rows, const int n_cols) {
+void print_csum(const HeightField &matrix_ht) {
+    const int n_rows = matrix_ht.n_rows(), n_cols = matrix_ht.n_cols();
     int row, col;
     // the max entry and its number of digits (formatting purposes)
-    int max_entry = (n_rows + n_cols - matrix_ht[n_rows-1][n_cols-1]) / 2;
+    int max_entry = (n_rows + n_cols - matrix_ht.get(n_rows-1, n_cols-1)) / 2;
     int num_digits = ((int) std::floor(std::log10(max_entry))) + 1;
     for (row = 0; row < n_rows; ++row) {
         for (col = 0; col < n_cols; ++col)
-            std::printf("%*d", num_digits+1, (row + col + 2 - matrix_ht[row][col])/2);
+            std::printf("%*d", num_digits+1, (row + col + 2 - matrix_ht.get(row, col))/2);
         std::printf("\n");
     }
 }
 
-void print_asm(int **matrix_ht, const int n_rows, const int n_cols) {
+void print_asm(const HeightField &matrix_ht) {
+    const int n_rows = matrix_ht.n_rows(), n_cols = matrix_ht.n_cols();
     int row, col;
     // start at 1, because we're reading the ASM from the 
     // + 1 bigger size height function
     for (row = 1; row < n_rows; ++row) {
         for (col = 1; col < n_cols; ++col)
-            std::printf("%2d ",(matrix_ht[row-1][col] + matrix_ht[row][col-1] 
-                        - matrix_ht[row][col] - matrix_ht[row-1][col-1]) / 2);
+            std::printf("%2d ",(matrix_ht.get(row-1, col) + matrix_ht.get(row, col-1) 
+                        - matrix_ht.get(row, col) - matrix_ht.get(row-1, col-1)) / 2);
         std::printf("\n");
     }
 }
 
-void print_asm_to_file(int **matrix_ht, const int n_rows, const int n_cols) {
+void print_trajectory(std::FILE *out, const Trajectory &trajectory) {
+    std::fprintf(out, "# time volume");
+    for(const Observable &observable : trajectory.observables())
+        for(int k=0; k<observable.size; ++k)
+            if(observable.size == 1)
+                std::fprintf(out, " %s", observable.name);
+            else
+                std::fprintf(out, " %s_%d", observable.name, k);
+    std::fprintf(out, "\n");
+    for(int t=trajectory.times()-1; t>=0; --t) {
+        if(trajectory.volume(t) < 0)
+            continue;
+        std::fprintf(out, "%d %lld", -t, trajectory.volume(t));
+        for(std::size_t i=0; i<trajectory.observables().size(); ++i)
+            for(int k=0; k<trajectory.observables()[i].size; ++k)
+                std::fprintf(out, " %.10g", trajectory.values(t, i)[k]);
+        std::fprintf(out, "\n");
+    }
+}
+
+void print_stats(std::FILE *out, const Accumulator &stats) {
+    const long long n = stats.count();
+    std::fprintf(out, "# samples %lld\n", n);
+    for(std::size_t i=0; i<stats.observables().size(); ++i) {
+        const Observable &observable = stats.observables()[i];
+        const double *sums = stats.sums(i), *squares = stats.squares(i);
+        std::fprintf(out, "# %s mean\n", observable.name);
+        for(int k=0; k<observable.size; ++k)
+            std::fprintf(out, k ? " %.10g" : "%.10g", n ? sums[k] / n : 0.0);
+        std::fprintf(out, "\n# %s sd\n", observable.name);
+        for(int k=0; k<observable.size; ++k) {
+            // of the samples, with n - 1 (0 for a single one)
+            const double variance = n > 1 ? (squares[k] - sums[k] * sums[k] / n)
+                                            / (n - 1) : 0.0;
+            std::fprintf(out, k ? " %.10g" : "%.10g",
+                         std::sqrt(std::max(variance, 0.0)));
+        }
+        std::fprintf(out, "\n");
+    }
+}
+
+void print_asm_to_file(const HeightField &matrix_ht) {
+    const int n_rows = matrix_ht.n_rows(), n_cols = matrix_ht.n_cols();
     int row, col;
     FILE *fptr1;
     FILE *fptr2;
@@ -291,8 +893,8 @@ void print_asm_to_file(int **matrix_ht, const int n_rows, const int n_cols) {
 
     for (row = 1; row < n_rows; ++row) {
         for (col = 1; col < n_cols; ++col){
-            int entry = (int) (matrix_ht[row-1][col] + matrix_ht[row][col-1] 
-                       - matrix_ht[row][col] - matrix_ht[row-1][col-1]) / 2;
+            int entry = (int) (matrix_ht.get(row-1, col) + matrix_ht.get(row, col-1) 
+                       - matrix_ht.get(row, col) - matrix_ht.get(row-1, col-1)) / 2;
             if (entry == 0) {
                 std::fprintf(fptr1, "%s", "  ");
                 std::fprintf(fptr2, (col == 1) ? "%d" : "%3d", entry);
@@ -313,3 +915,59 @@ void print_asm_to_file(int **matrix_ht, const int n_rows, const int n_cols) {
     std::fclose(fptr2);
 }
 
+
+void write_bin(std::FILE *out, const HeightField &matrix_ht, const int kind,
+               const int index, const int seed, const long long steps) {
+    const int n_rows = matrix_ht.n_rows(), n_cols = matrix_ht.n_cols();
+    const int order = n_rows - 1;
+    int row, col;
+    // header and payload go out together, in one write
+    std::size_t payload = (kind == BIN_ASM)
+        ? ((std::size_t) order * order + 3) / 4
+        : (std::size_t) n_rows * ((n_cols + 7) / 8);
+    std::vector<unsigned char> record(32 + payload, 0);
+    const int origin = matrix_ht.get(0, 0);
+    std::memcpy(&record[0], "RASM", 4);
+    record[4] = 1;
+    record[5] = (unsigned char) kind;
+    std::memcpy(&record[8], &order, 4);
+    std::memcpy(&record[12], &index, 4);
+    std::memcpy(&record[16], &seed, 4);
+    std::memcpy(&record[20], &origin, 4);
+    std::memcpy(&record[24], &steps, 8);
+
+    unsigned char *bytes = &record[32];
+    if(kind == BIN_ASM) {
+        std::size_t k = 0;
+        for (row = 1; row < n_rows; ++row)
+            for (col = 1; col < n_cols; ++col, ++k) {
+                int entry = (matrix_ht.get(row-1, col) + matrix_ht.get(row, col-1)
+                             - matrix_ht.get(row, col) - matrix_ht.get(row-1, col-1)) / 2;
+                bytes[k / 4] |= (entry & 3) << (2 * (k % 4));
+            }
+    }
+    else {
+        const int row_bytes = (n_cols + 7) / 8;
+        for (row = 0; row < n_rows; ++row) {
+            unsigned char *bits = bytes + (std::size_t) row * row_bytes;
+            if(row > 0 && matrix_ht.get(row, 0) > matrix_ht.get(row-1, 0))
+                bits[0] |= 1;
+            for (col = 1; col < n_cols; ++col)
+                if(matrix_ht.get(row, col) > matrix_ht.get(row, col-1))
+                    bits[col / 8] |= 1 << (col % 8);
+        }
+    }
+    std::fwrite(record.data(), 1, record.size(), out);
+}
+
+std::string initial_cache_path(const char *argv0) {
+    const char *dir = std::getenv("RASM_CACHE_DIR");
+    if(dir != NULL && *dir)
+        return std::string(dir) + "/rasm_initial.txt";
+    // next to the program
+    std::string program(argv0);
+    std::size_t slash = program.rfind('/');
+    if(slash == std::string::npos)
+        return "rasm_initial.txt";
+    return program.substr(0, slash + 1) + "rasm_initial.txt";
+}
@@ -7,27 +7,73 @@
 void print_options();
 
 /// @brief Prints the height function to stdout
-/// @param matrix_ht an int matrix, the height function
-/// @param n_rows number of rows of matrix_ht
-/// @param n_cols number of columns of matrix_ht
-void print_ht(int **matrix_ht, const int n_rows, const int n_cols);
+/// @param matrix_ht the height function
+void print_ht(const HeightField &matrix_ht);
 
 /// @brief Prints the corner sum matrix to stdout
-/// @param matrix_ht an int matrix, the height function
-/// @param n_rows number of rows of matrix_ht
-/// @param n_cols number of columns of matrix_ht
-void print_csum(int **matrix_ht, const int n_rows, const int n_cols);
+/// @param matrix_ht the height function
+void print_csum(const HeightField &matrix_ht);
 
 /// @brief Prints the ASM to stdout
-/// @param matrix_ht an int matrix, the height function
-/// @param n_rows number of rows of matrix_ht
-/// @param n_cols number of columns of matrix_ht
-void print_asm(int **matrix_ht, const int n_rows, const int n_cols);
+/// @param matrix_ht the height function
+void print_asm(const HeightField &matrix_ht);
 
 /// @brief Prints the ASM to two files 
-/// @param matrix_ht an int matrix, the height function
-/// @param n_rows number of rows of matrix_ht
-/// @param n_cols number of columns of matrix_ht
-void print_asm_to_file(int **matrix_ht, const int n_rows, const int n_cols);
+/// @param matrix_ht the height function
+void print_asm_to_file(const HeightField &matrix_ht);
+
+/// @brief Writes a trajectory as text: a "# time volume ..." header with
+/// the names of the values (name_k for the k-th of an observable of
+/// several), then a line per recorded time from the earliest to 0
+/// @param out the file to write to
+/// @param trajectory the trajectory of run_cftp
+void print_trajectory(std::FILE *out, const Trajectory &trajectory);
+
+/// @brief Writes the statistics of an accumulator as text: "# samples n",
+/// then for each observable a "# name mean" line and a line with the
+/// means of its values, and the same with "sd" for their standard
+/// deviations
+/// @param out the file to write to
+/// @param stats the sums of the samples
+void print_stats(std::FILE *out, const Accumulator &stats);
+
+/// @brief Prints the wall and CPU time of each phase to stderr
+/// @param timer the timer of the sample
+void print_timings(const PhaseTimer &timer);
+
+/// @brief The cache file of -initial auto: rasm_initial.txt in the
+/// directory $RASM_CACHE_DIR if set, else next to the program
+/// @param argv0 the path of the program
+/// @return the path of the cache file
+std::string initial_cache_path(const char *argv0);
+
+/// @brief What a binary record holds
+enum bin_kind {BIN_ASM = 0, BIN_HEIGHT = 1};
+
+/// @brief Writes a sample as one binary record, in a single fwrite.
+/// The record is a 32 byte header, all little-endian:
+///   bytes  0-3  "RASM"
+///   byte   4    format version (1)
+///   byte   5    kind, BIN_ASM or BIN_HEIGHT
+///   bytes  6-7  zero
+///   bytes  8-11 int32 order of the ASM
+///   bytes 12-15 int32 index of the sample in its batch
+///   bytes 16-19 int32 random seed of the sample
+///   bytes 20-23 int32 height at (0, 0)
+///   bytes 24-31 int64 number of steps that coalesced
+/// followed, for BIN_ASM, by the order x order entries row by row, 2 bits
+/// each (0, 1 or 3 for -1), entry k in bits 2*(k%4) of byte k/4;
+/// and for BIN_HEIGHT, by one bit per entry of the (order+1) x (order+1)
+/// height function, each row padded to whole bytes, bit c%8 of byte c/8:
+/// set if the entry is 1 more than its left neighbour (column 0: than the
+/// entry above, ignored for (0, 0)), clear if it is 1 less
+/// @param out the file to write to
+/// @param matrix_ht the height function
+/// @param kind BIN_ASM or BIN_HEIGHT
+/// @param index the index of the sample in its batch
+/// @param seed the random seed of the sample
+/// @param steps the number of steps that coalesced
+void write_bin(std::FILE *out, const HeightField &matrix_ht, const int kind,
+               const int index, const int seed, const long long steps);
 
 #endif
@@ -154,12 +154,15 @@ int main(int argc, char **argv) {
     n_cols = order + 1; 
 
     // declare the min and max height functions
-    // allocate memory
+    // allocate memory: one contiguous block per matrix, plus an array
+    // of pointers to the start of each row so we can write [row][col]
     int **minimum_ht = new int*[n_rows];
     int **maximum_ht = new int*[n_rows];
-    for(int i = 0; i < n_rows; ++i) {
-        minimum_ht[i] = new int[n_cols];
-        maximum_ht[i] = new int[n_cols];
+    minimum_ht[0] = new int[n_rows * n_cols];
+    maximum_ht[0] = new int[n_rows * n_cols];
+    for(int i = 1; i < n_rows; ++i) {
+        minimum_ht[i] = minimum_ht[0] + i * n_cols;
+        maximum_ht[i] = maximum_ht[0] + i * n_cols;
     }
 
     if (argc > 2)
@@ -301,10 +304,8 @@ int main(int argc, char **argv) {
     // std::cerr<<std::endl;
 
     // deallocate memory
-    for(int i = 0; i < n_rows; ++i) {
-        delete [] minimum_ht[i];
-        delete [] maximum_ht[i];
-    }
+    delete [] minimum_ht[0];
+    delete [] maximum_ht[0];
     delete [] minimum_ht;
     delete [] maximum_ht;
 
@@ -0,0 +1,333 @@
+// Benchmarks of the building blocks of rasm, written out as JSON to track
+// regressions (e.g. when changing the kernels):
+//   - evolve_ht, site updates per second, with the min and max apart (a
+//     run's early sweeps) and coalesced (its late ones), and as 8 sweeps
+//     at a time by evolve_ht_sweeps,
+//   - initialize_ht and volume_diff,
+//   - the output paths: print_asm, print_ht, print_csum and write_bin,
+// each at several orders, and the distribution over seeds of the time it
+// takes to sample an ASM (CftpSampler, as ./rasm order -seed s does).
+// Build and run with make bench, see print_bench_options for the options.
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <functional>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <ctime>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "rasm.h"
+
+/// @brief Prints the options available at the command line
+void print_bench_options() {
+    std::cout << std::endl;
+    std::cout << "Usage: ./rasm_bench [options], where [options] are:\n";
+    std::cout << std::endl;
+    std::cout << "   -orders <list>          orders of the building blocks (default 10,30,100,300,1000,2000)\n";
+    std::cout << "   -latency_orders <list>  orders of the sampling latency (default 10,30,50,100)\n";
+    std::cout << "   -seeds <value>          seeds 1 to value for the latency (default 20)\n";
+    std::cout << "   -initial <value>        initial number of steps of the samples (default 128)\n";
+    std::cout << "   -min_time <seconds>     time each building block at least this long (default 0.2)\n";
+    std::cout << "   -kernel <name>          sweep kernel: scalar, avx2 or auto (default)\n";
+    std::cout << "   -out <file>             write the JSON to file (default, standard output)\n";
+    std::cout << std::endl;
+    std::exit(1);
+}
+
+/// @brief Parses a comma separated list of positive integers
+std::vector<int> parse_orders(const char *list) {
+    std::vector<int> orders;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) {
+        const int order = std::stoi(item);
+        if(order < 1) {
+            std::cerr << "Invalid order " << order << std::endl;
+            std::exit(1);
+        }
+        orders.push_back(order);
+    }
+    return orders;
+}
+
+/// @brief Calls f until min_time seconds (wall) have gone by
+/// @param iterations output, the number of calls
+/// @param cpu_seconds output, CPU seconds per call
+/// @return wall seconds per call
+double time_per_call(const std::function<void()> &f, const double min_time,
+                     long long &iterations, double &cpu_seconds) {
+    PhaseTimer timer;
+    iterations = 0;
+    timer.enter(PhaseTimer::SAMPLING);
+    do {
+        f();
+        ++iterations;
+    } while(timer.wall() < min_time);
+    timer.stop();
+    cpu_seconds = timer.cpu() / iterations;
+    return timer.wall() / iterations;
+}
+
+/// @brief Writes one timing as a JSON object
+void write_timing(std::FILE *out, const bool first, const char *name,
+                  const int order, const int width, const long long iterations,
+                  const double seconds, const double cpu_seconds,
+                  const double site_updates = 0) {
+    std::fprintf(out, "%s\n    {\"name\": \"%s\", \"order\": %d, \"width\": %d, "
+                 "\"iterations\": %lld, \"seconds_per_iteration\": %.9g, "
+                 "\"cpu_seconds_per_iteration\": %.9g",
+                 first ? "" : ",", name, order, width, iterations, seconds,
+                 cpu_seconds);
+    if(site_updates > 0)
+        std::fprintf(out, ", \"site_updates_per_second\": %.6g",
+                     site_updates / seconds);
+    std::fprintf(out, "}");
+}
+
+/// @brief The q-th quantile (0 <= q <= 1) of sorted values, nearest rank
+double quantile(const std::vector<double> &sorted, const double q) {
+    std::size_t rank = (std::size_t) (q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+/// @brief Writes "name": {min, median, p90, max, mean} of values, and a
+/// comma, sorting values
+void write_distribution(std::FILE *out, const char *name,
+                        std::vector<double> &values) {
+    double total = 0;
+    for(const double value : values)
+        total += value;
+    std::sort(values.begin(), values.end());
+    std::fprintf(out, "\"%s\": {\"min\": %.9g, \"median\": %.9g, \"p90\": %.9g, "
+                 "\"max\": %.9g, \"mean\": %.9g}, ", name, values.front(),
+                 quantile(values, 0.5), quantile(values, 0.9), values.back(),
+                 total / values.size());
+}
+
+int main(int argc, char **argv) {
+    std::vector<int> orders = {10, 30, 100, 300, 1000, 2000};
+    std::vector<int> latency_orders = {10, 30, 50, 100};
+    int n_seeds = 20, initial = 128;
+    double min_time = 0.2;
+    const char *out_file = NULL;
+
+    for(int count=1; count<argc; ++count) {
+        if(!strcmp(argv[count], "-help"))
+            print_bench_options();
+        if(count == argc - 1) {
+            std::cerr << "Missing value of " << argv[count] << std::endl;
+            print_bench_options();
+        }
+        const char *value = argv[++count];
+        if(!strcmp(argv[count-1], "-orders"))
+            orders = parse_orders(value);
+        else if(!strcmp(argv[count-1], "-latency_orders"))
+            latency_orders = parse_orders(value);
+        else if(!strcmp(argv[count-1], "-seeds"))
+            n_seeds = std::stoi(value);
+        else if(!strcmp(argv[count-1], "-initial"))
+            initial = std::stoi(value);
+        else if(!strcmp(argv[count-1], "-min_time"))
+            min_time = std::stod(value);
+        else if(!strcmp(argv[count-1], "-out"))
+            out_file = value;
+        else if(!strcmp(argv[count-1], "-kernel")) {
+            if(!set_evolve_kernel(value)) {
+                std::cerr << "Invalid or unsupported kernel " << value << std::endl;
+                std::exit(1);
+            }
+        }
+        else {
+            std::cerr << "Illegal command line argument " << argv[count-1] << std::endl;
+            print_bench_options();
+        }
+    }
+    if(n_seeds < 1 || initial < 1 || min_time <= 0) {
+        std::cerr << "-seeds, -initial and -min_time must be positive\n";
+        std::exit(1);
+    }
+
+    // the JSON goes to a copy of standard output, which the print
+    // benchmarks redirect to /dev/null
+    std::FILE *out = out_file == NULL ? fdopen(dup(STDOUT_FILENO), "w")
+                                      : std::fopen(out_file, "w");
+    if(out == NULL) {
+        std::cerr << "Could not open " << (out_file ? out_file : "stdout") << std::endl;
+        std::exit(1);
+    }
+    const int null_fd = open("/dev/null", O_WRONLY);
+    std::FILE *null_file = std::fopen("/dev/null", "w");
+    if(null_fd < 0 || null_file == NULL) {
+        std::cerr << "Could not open /dev/null\n";
+        std::exit(1);
+    }
+    const int threads =
+#ifdef _OPENMP
+        omp_get_max_threads();
+#else
+        1;
+#endif
+
+    std::fprintf(out, "{\n  \"kernel\": \"%s\",\n  \"threads\": %d,\n"
+                 "  \"min_time\": %g,\n  \"benchmarks\": [",
+                 evolve_kernel_name(), threads, min_time);
+    bool first = true;
+    for(const int order : orders) {
+        std::cerr << "Order " << order << "..." << std::endl;
+        const int n = order + 1, width = ht_width(n);
+        const double sites = (double) (n - 2) * (n - 2); // updatable sites
+        HeightField minimum_ht(n, n, width), maximum_ht(n, n, width);
+        long long iterations = 0;
+        double seconds, cpu_seconds;
+
+        // the min and max apart: every block of 64 sweeps starts from
+        // initialize_ht (untimed), far from coalescing at these orders
+        long long step = 1 << 30;
+        PhaseTimer timer;
+        do {
+            timer.enter(PhaseTimer::INITIALIZATION);
+            initialize_ht(minimum_ht, maximum_ht);
+            timer.enter(PhaseTimer::SAMPLING);
+            for(int k=0; k<64; ++k)
+                evolve_ht(minimum_ht, maximum_ht, 1, step--);
+            iterations += 64;
+        } while(timer.wall(PhaseTimer::SAMPLING) < min_time);
+        timer.stop();
+        seconds = timer.wall(PhaseTimer::SAMPLING) / iterations;
+        write_timing(out, first, "evolve_ht", order, width, iterations, seconds,
+                     timer.cpu(PhaseTimer::SAMPLING) / iterations, 2 * sites);
+        first = false;
+
+        // the same, 8 sweeps at a time (seconds per sweep)
+        iterations = 0;
+        timer = PhaseTimer();
+        do {
+            timer.enter(PhaseTimer::INITIALIZATION);
+            initialize_ht(minimum_ht, maximum_ht);
+            timer.enter(PhaseTimer::SAMPLING);
+            for(int k=0; k<64; k+=8, step-=8)
+                evolve_ht_sweeps(minimum_ht, maximum_ht, 1, step, 8);
+            iterations += 64;
+        } while(timer.wall(PhaseTimer::SAMPLING) < min_time);
+        timer.stop();
+        seconds = timer.wall(PhaseTimer::SAMPLING) / iterations;
+        write_timing(out, first, "evolve_ht_sweeps_8", order, width, iterations,
+                     seconds, timer.cpu(PhaseTimer::SAMPLING) / iterations,
+                     2 * sites);
+
+        // the same, min and max side by side (HeightPair)
+        HeightPair pair(n, n, width);
+        iterations = 0;
+        timer = PhaseTimer();
+        do {
+            timer.enter(PhaseTimer::INITIALIZATION);
+            initialize_ht(pair);
+            timer.enter(PhaseTimer::SAMPLING);
+            for(int k=0; k<64; ++k)
+                evolve_ht(pair, 1, step--);
+            iterations += 64;
+        } while(timer.wall(PhaseTimer::SAMPLING) < min_time);
+        timer.stop();
+        seconds = timer.wall(PhaseTimer::SAMPLING) / iterations;
+        write_timing(out, first, "evolve_ht_pair", order, width, iterations,
+                     seconds, timer.cpu(PhaseTimer::SAMPLING) / iterations,
+                     2 * sites);
+
+        // coalesced: a single height function
+        seconds = time_per_call([&]() {
+                evolve_ht(maximum_ht, maximum_ht, 2, step--);
+            }, min_time, iterations, cpu_seconds);
+        write_timing(out, first, "evolve_ht_coalesced", order, width,
+                     iterations, seconds, cpu_seconds, sites);
+
+        seconds = time_per_call([&]() {
+                initialize_ht(minimum_ht, maximum_ht);
+            }, min_time, iterations, cpu_seconds);
+        write_timing(out, first, "initialize_ht", order, width, iterations,
+                     seconds, cpu_seconds);
+
+        // a random looking max to output (and to take the volume of)
+        for(int k=0; k<256; ++k)
+            evolve_ht(maximum_ht, maximum_ht, 3, k + 1);
+        seconds = time_per_call([&]() {
+                volume_diff(minimum_ht, maximum_ht);
+            }, min_time, iterations, cpu_seconds);
+        write_timing(out, first, "volume_diff", order, width, iterations,
+                     seconds, cpu_seconds);
+
+        pair.pack(minimum_ht, maximum_ht);
+        seconds = time_per_call([&]() { volume_diff(pair); }, min_time,
+                                iterations, cpu_seconds);
+        write_timing(out, first, "volume_diff_pair", order, width, iterations,
+                     seconds, cpu_seconds);
+
+        std::fflush(stdout);
+        const int saved_fd = dup(STDOUT_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        const std::pair<const char *, std::function<void()> > outputs[] = {
+            {"print_asm", [&]() { print_asm(maximum_ht); std::fflush(stdout); }},
+            {"print_ht", [&]() { print_ht(maximum_ht); std::fflush(stdout); }},
+            {"print_csum", [&]() { print_csum(maximum_ht); std::fflush(stdout); }},
+            {"write_bin_asm", [&]() {
+                write_bin(null_file, maximum_ht, BIN_ASM, 0, 0, 0); }},
+            {"write_bin_height", [&]() {
+                write_bin(null_file, maximum_ht, BIN_HEIGHT, 0, 0, 0); }}};
+        for(const auto &output : outputs) {
+            seconds = time_per_call(output.second, min_time, iterations,
+                                    cpu_seconds);
+            write_timing(out, first, output.first, order, width, iterations,
+                         seconds, cpu_seconds);
+        }
+        std::fflush(stdout);
+        dup2(saved_fd, STDOUT_FILENO);
+        close(saved_fd);
+    }
+    std::fprintf(out, "\n  ],\n  \"latency\": [");
+
+    // full samples: seeds 1 to n_seeds of each order, the same as
+    // ./rasm order -seed s -initial initial, wall and CPU time, also by
+    // phase (summed over the seeds)
+    first = true;
+    for(const int order : latency_orders) {
+        std::cerr << "Latency of order " << order << "..." << std::endl;
+        CftpSampler sampler;
+        PhaseTimer phases;
+        std::vector<double> seconds, cpu_seconds, steps;
+        for(int seed=1; seed<=n_seeds; ++seed) {
+            const double wall = phases.wall(), cpu = phases.cpu();
+            steps.push_back(sampler.sample_seeded(order, seed, initial, 0, &phases));
+            seconds.push_back(phases.wall() - wall);
+            cpu_seconds.push_back(phases.cpu() - cpu);
+        }
+        std::fprintf(out, "%s\n    {\"order\": %d, \"seeds\": %d, \"initial\": %d, ",
+                     first ? "" : ",", order, n_seeds, initial);
+        write_distribution(out, "seconds", seconds);
+        write_distribution(out, "cpu_seconds", cpu_seconds);
+        std::sort(steps.begin(), steps.end());
+        std::fprintf(out, "\"steps\": {\"min\": %.0f, \"median\": %.0f, \"max\": %.0f}, "
+                     "\"phases\": {", steps.front(), quantile(steps, 0.5), steps.back());
+        for(int phase=0; phase<PhaseTimer::N_PHASES; ++phase)
+            std::fprintf(out, "%s\"%s\": {\"seconds\": %.9g, \"cpu_seconds\": %.9g}",
+                         phase ? ", " : "", PhaseTimer::name((PhaseTimer::Phase) phase),
+                         phases.wall((PhaseTimer::Phase) phase),
+                         phases.cpu((PhaseTimer::Phase) phase));
+        std::fprintf(out, "}}");
+        first = false;
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+    std::fclose(out);
+    std::fclose(null_file);
+    close(null_fd);
+    return 0;
+}
@@ -0,0 +1,374 @@
+#ifndef RASM_KERNEL
+#define RASM_KERNEL
+
+// Row update kernels used by evolve_ht, templated on the type T of the
+// height function entries (int8_t, int16_t or int, see ht_width).
+// A kernel updates the sites of one row and one phase of both height
+// functions, with the coin of site (row, col) read from the row's coins,
+// and returns the change this made to volume_diff (every flip moves a
+// height by +-2).
+// With Both = false the row and its neighbours must be the same in both
+// height functions (coalesced): then only the max is updated and its new
+// entries are also written to the min, which is what updating both would
+// have given, and the volume doesn't change.
+// With Count = true the kernel also adds the number of sites whose height
+// changed to flips[0] (min) and flips[1] (max); otherwise flips is unused
+// and the kernel is exactly the one without counting.
+
+/// @brief Checks if site col of the row cur can be flipped
+/// @param up the row above
+/// @param cur the row of the site
+/// @param down the row below
+/// @param col the column being checked
+/// @return true if site can be flipped
+template<typename T>
+inline bool is_extreme_at(const T *up, const T *cur, const T *down,
+                          const int col) {
+    return (up[col] == cur[col+1] &&
+            cur[col+1] == down[col] &&
+            down[col] == cur[col-1]);
+}
+
+/// @brief Updates the sites of one row from column col on, every other
+/// column, one site at a time
+template<typename T, bool Both, bool Count>
+inline int update_sites_scalar(HeightField &minimum_ht, HeightField &maximum_ht,
+                               const int row, int col, const uint32_t *bits,
+                               int *flips) {
+    const int n_cols = minimum_ht.n_cols();
+    int delta = 0, min_flips = 0, max_flips = 0;
+    const T *min_up = minimum_ht.row<T>(row-1), *min_down = minimum_ht.row<T>(row+1);
+    const T *max_up = maximum_ht.row<T>(row-1), *max_down = maximum_ht.row<T>(row+1);
+    T *min_cur = minimum_ht.row<T>(row), *max_cur = maximum_ht.row<T>(row);
+    for(; col<n_cols-1; col+=2) {
+        // uniform random +1 or -1
+        short coin_flip = (bits[col >> 5] >> (col & 31)) & 1 ? 1 : -1;
+        if(Both && is_extreme_at(min_up, min_cur, min_down, col)) {
+            const T old = min_cur[col];
+            min_cur[col] = min_up[col] + coin_flip;
+            delta += old - min_cur[col];
+            if(Count)
+                min_flips += old != min_cur[col];
+        }
+        if(is_extreme_at(max_up, max_cur, max_down, col)) {
+            const T old = max_cur[col];
+            max_cur[col] = max_up[col] + coin_flip;
+            delta += max_cur[col] - old;
+            if(Count)
+                max_flips += old != max_cur[col];
+            if(!Both)
+                min_cur[col] = max_cur[col];
+        }
+    }
+    if(Count) {
+        flips[0] += Both ? min_flips : max_flips;
+        flips[1] += max_flips;
+    }
+    return Both ? delta : 0;
+}
+
+/// @brief Updates the sites of one row and one phase, one site at a time
+template<typename T, bool Both, bool Count>
+int update_row_scalar(HeightField &minimum_ht, HeightField &maximum_ht,
+                      const int row, const int phase, const uint32_t *bits,
+                      int *flips) {
+    // invariant: (row + col) % 2 == phase
+    return update_sites_scalar<T, Both, Count>(minimum_ht, maximum_ht, row,
+                                               row%2==phase ? 2 : 1, bits, flips);
+}
+
+// Kernels for a HeightPair: the min and max heights of site (row, col)
+// are entries 2 * col and 2 * col + 1 of the row, both are tested and
+// flipped with the site's coin in the same pass, and the change to
+// volume_diff is returned as above.
+
+/// @brief Updates the sites of one row of a pair from column col on, every
+/// other column, one site at a time
+template<typename T>
+inline int update_pair_sites_scalar(HeightPair &pair, const int row, int col,
+                                    const uint32_t *bits) {
+    const int n_cols = pair.n_cols();
+    int delta = 0;
+    const T *up = pair.row<T>(row-1), *down = pair.row<T>(row+1);
+    T *cur = pair.row<T>(row);
+    for(; col<n_cols-1; col+=2) {
+        // uniform random +1 or -1
+        short coin_flip = (bits[col >> 5] >> (col & 31)) & 1 ? 1 : -1;
+        for(int i=2*col; i<2*col+2; ++i)
+            if(up[i] == cur[i+2] && cur[i+2] == down[i] && down[i] == cur[i-2]) {
+                const T old = cur[i];
+                cur[i] = up[i] + coin_flip;
+                // i odd: the max
+                delta += i % 2 ? cur[i] - old : old - cur[i];
+            }
+    }
+    return delta;
+}
+
+/// @brief Updates the sites of one row and one phase of a pair, one site
+/// at a time
+template<typename T>
+int update_pair_row_scalar(HeightPair &pair, const int row, const int phase,
+                           const uint32_t *bits) {
+    // invariant: (row + col) % 2 == phase
+    return update_pair_sites_scalar<T>(pair, row, row%2==phase ? 2 : 1, bits);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RASM_HAVE_AVX2
+
+/// one AVX2 register of T's: 8 ints, 16 int16_t's or 32 int8_t's
+template<typename T> struct avx2_vec {
+    typedef T type __attribute__((vector_size(32)));
+};
+
+/// coins[b][j] is the coin (+1 or -1) given by bit j of the byte b
+template<typename T> struct CoinTable {
+    T coins[256][8];
+    CoinTable() {
+        for(int b=0; b<256; ++b)
+            for(int j=0; j<8; ++j)
+                coins[b][j] = (b >> j) & 1 ? 1 : -1;
+    }
+};
+
+template<typename T> const CoinTable<T> &coin_table() {
+    static const CoinTable<T> table;
+    return table;
+}
+
+/// @brief Updates the lanes of one register of a row whose parity mask is
+/// set: the lanes of the wrong parity are exactly the left/right
+/// neighbours of the lanes being written, so updating in place is safe
+/// @param mirror if not NULL, also gets the updated register
+/// @return the new minus the old entries, lane by lane
+template<typename T>
+__attribute__((target("avx2")))
+inline typename avx2_vec<T>::type
+update_chain_avx2(const T *up, T *cur, const T *down, const int c,
+                  const typename avx2_vec<T>::type parity,
+                  const typename avx2_vec<T>::type coin, T *mirror = NULL) {
+    typedef typename avx2_vec<T>::type vec;
+    vec u, d, l, r, me;
+    std::memcpy(&u, up + c, sizeof(vec));
+    std::memcpy(&d, down + c, sizeof(vec));
+    std::memcpy(&l, cur + c - 1, sizeof(vec));
+    std::memcpy(&r, cur + c + 1, sizeof(vec));
+    std::memcpy(&me, cur + c, sizeof(vec));
+    // the "all four neighbours equal" mask (lanes are 0 or -1)
+    vec extreme = (u == r) & (r == d) & (d == l) & parity;
+    vec updated = extreme ? u + coin : me;
+    std::memcpy(cur + c, &updated, sizeof(vec));
+    if(mirror != NULL)
+        std::memcpy(mirror + c, &updated, sizeof(vec));
+    return updated - me;
+}
+
+/// @brief Updates the sites of one row and one phase, one AVX2 register
+/// (32 bytes of columns) at a time
+template<typename T, bool Both, bool Count>
+__attribute__((target("avx2")))
+int update_row_avx2(HeightField &minimum_ht, HeightField &maximum_ht,
+                    const int row, const int phase, const uint32_t *bits,
+                    int *flips) {
+    typedef typename avx2_vec<T>::type vec;
+    const int lanes = sizeof(vec) / sizeof(T);
+    const int n_cols = minimum_ht.n_cols();
+    const CoinTable<T> &table = coin_table<T>();
+
+    // lane j of a register starting at col holds column col + j, it is
+    // updated if (row + col + j) % 2 == phase; registers start at odd columns
+    const T odd = (row + 1) % 2 == phase ? -1 : 0;
+    vec parity;
+    for(int j=0; j<lanes; ++j)
+        parity[j] = j % 2 ? ~odd : odd;
+
+    // lane by lane sum of the changes to max - min, each register adds at
+    // most 4 to a lane, which stays well within T for the orders that
+    // ht_width gives T to (at most 4 registers per row for int8_t)
+    vec diff = {};
+    // lane by lane counts of the changed sites, as bounded as diff
+    vec min_flips = {}, max_flips = {};
+    int col = 1;
+    // stay off the boundary: column n_cols - 1 is read but never written
+    for(; col+lanes<=n_cols-1; col+=lanes) {
+        // the coins of columns col to col + lanes - 1, lanes <= 32
+        uint64_t b = bits[col >> 5];
+        if((col & 31) + lanes > 32)
+            b |= (uint64_t) bits[(col >> 5) + 1] << 32;
+        b >>= (col & 31);
+        vec coin;
+        for(int k=0; k<lanes/8; ++k)
+            std::memcpy((T *) &coin + 8*k, table.coins[(b >> 8*k) & 0xFF],
+                        8 * sizeof(T));
+        if(Both) {
+            const vec min_change = update_chain_avx2<T>(minimum_ht.row<T>(row-1),
+                                                        minimum_ht.row<T>(row),
+                                                        minimum_ht.row<T>(row+1),
+                                                        col, parity, coin);
+            const vec max_change = update_chain_avx2<T>(maximum_ht.row<T>(row-1),
+                                                        maximum_ht.row<T>(row),
+                                                        maximum_ht.row<T>(row+1),
+                                                        col, parity, coin);
+            diff += max_change - min_change;
+            if(Count) {
+                // a comparison gives -1 in the lanes where it holds
+                min_flips -= min_change != 0;
+                max_flips -= max_change != 0;
+            }
+        }
+        else {
+            const vec change = update_chain_avx2<T>(maximum_ht.row<T>(row-1),
+                                                    maximum_ht.row<T>(row),
+                                                    maximum_ht.row<T>(row+1), col,
+                                                    parity, coin, minimum_ht.row<T>(row));
+            if(Count)
+                max_flips -= change != 0;
+        }
+    }
+    int delta = 0;
+    for(int j=0; j<lanes; ++j)
+        delta += diff[j];
+    if(Count) {
+        for(int j=0; j<lanes; ++j) {
+            flips[0] += Both ? min_flips[j] : max_flips[j];
+            flips[1] += max_flips[j];
+        }
+    }
+
+    // the remaining columns one at a time
+    if((row + col) % 2 != phase)
+        ++col;
+    return delta + update_sites_scalar<T, Both, Count>(minimum_ht, maximum_ht,
+                                                       row, col, bits, flips);
+}
+
+/// coins[b][2j] = coins[b][2j + 1] is the coin given by bit j of the byte
+/// b, for the min and max of a site of a pair
+template<typename T> struct PairCoinTable {
+    T coins[256][16];
+    PairCoinTable() {
+        for(int b=0; b<256; ++b)
+            for(int j=0; j<16; ++j)
+                coins[b][j] = (b >> (j / 2)) & 1 ? 1 : -1;
+    }
+};
+
+template<typename T> const PairCoinTable<T> &pair_coin_table() {
+    static const PairCoinTable<T> table;
+    return table;
+}
+
+/// @brief The entries of a pair's row a site (2 entries) before those of
+/// the register me, given the register before it, without reading memory
+/// that has just been stored to (which would wait for the store)
+template<typename T>
+__attribute__((target("avx2")))
+inline typename avx2_vec<T>::type
+pair_left_avx2(const typename avx2_vec<T>::type before,
+               const typename avx2_vec<T>::type me) {
+    typedef typename avx2_vec<T>::type vec;
+    const int lanes = sizeof(vec) / sizeof(T);
+    vec shift;
+    for(int j=0; j<lanes; ++j)
+        shift[j] = lanes - 2 + j;
+    return __builtin_shuffle(before, me, shift);
+}
+
+/// @brief Updates the min and max lanes of one register of a pair's row
+/// (see update_chain_avx2) from its neighbours, and stores it at entry c
+/// @return the change to max - min, lane by lane
+template<typename T>
+__attribute__((target("avx2")))
+inline typename avx2_vec<T>::type
+update_pair_avx2(const T *up, T *cur, const T *down, const int c,
+                 const typename avx2_vec<T>::type l,
+                 const typename avx2_vec<T>::type me,
+                 const typename avx2_vec<T>::type parity,
+                 const typename avx2_vec<T>::type negate,
+                 const typename avx2_vec<T>::type coin) {
+    typedef typename avx2_vec<T>::type vec;
+    vec u, d, r;
+    std::memcpy(&u, up + c, sizeof(vec));
+    std::memcpy(&d, down + c, sizeof(vec));
+    std::memcpy(&r, cur + c + 2, sizeof(vec));
+    // the "all four neighbours equal" mask (lanes are 0 or -1)
+    vec extreme = (u == r) & (r == d) & (d == l) & parity;
+    vec updated = extreme ? u + coin : me;
+    std::memcpy(cur + c, &updated, sizeof(vec));
+    // the min lanes count negatively: -x = (x ^ -1) + 1
+    const vec change = updated - me;
+    return (change ^ negate) - negate;
+}
+
+/// @brief Updates the sites of one row and one phase of a pair, two AVX2
+/// registers (as many sites as one register has entries) at a time
+template<typename T>
+__attribute__((target("avx2")))
+int update_pair_row_avx2(HeightPair &pair, const int row, const int phase,
+                         const uint32_t *bits) {
+    typedef typename avx2_vec<T>::type vec;
+    const int lanes = sizeof(vec) / sizeof(T);
+    const int n_cols = pair.n_cols();
+    const PairCoinTable<T> &table = pair_coin_table<T>();
+    const T *up = pair.row<T>(row-1), *down = pair.row<T>(row+1);
+    T *cur = pair.row<T>(row);
+
+    // lanes j and j + 1 (j even) of a register starting at site col hold
+    // the min and max of site col + j / 2, which is updated if
+    // (row + col + j / 2) % 2 == phase; registers start at odd sites and
+    // have an even number of sites
+    const T odd = (row + 1) % 2 == phase ? -1 : 0;
+    vec parity, negate;
+    for(int j=0; j<lanes; ++j) {
+        parity[j] = (j / 2) % 2 ? ~odd : odd;
+        negate[j] = j % 2 ? 0 : -1;
+    }
+
+    // lane by lane sum of the changes to max - min, a lane moves by at most
+    // 2 per register: at most 16 for int8_t (orders below 126, 8 registers)
+    vec diff = {}, before = {};
+    int col = 1;
+    // stay off the boundary: site n_cols - 1 is read but never written
+    for(; col+lanes<=n_cols-1; col+=lanes) {
+        // the coins of sites col to col + lanes - 1, lanes <= 32, for
+        // both registers
+        uint64_t b = bits[col >> 5];
+        if((col & 31) + lanes > 32)
+            b |= (uint64_t) bits[(col >> 5) + 1] << 32;
+        b >>= (col & 31);
+        vec coins[2];
+        for(int k=0; k<lanes/8; ++k)
+            std::memcpy((T *) coins + 16*k, table.coins[(b >> 8*k) & 0xFF],
+                        16 * sizeof(T));
+        // the left neighbours of a register come from the one before it
+        // (as it was: the sites of the other parity, the only ones it
+        // needs, don't change)
+        vec me[2];
+        std::memcpy(&me[0], cur + 2*col, sizeof(vec));
+        std::memcpy(&me[1], cur + 2*col + lanes, sizeof(vec));
+        if(col == 1) {
+            // the first register's left neighbours start at entry 0
+            before[lanes-2] = cur[0];
+            before[lanes-1] = cur[1];
+        }
+        diff += update_pair_avx2<T>(up, cur, down, 2*col,
+                                    pair_left_avx2<T>(before, me[0]), me[0],
+                                    parity, negate, coins[0]);
+        diff += update_pair_avx2<T>(up, cur, down, 2*col + lanes,
+                                    pair_left_avx2<T>(me[0], me[1]), me[1],
+                                    parity, negate, coins[1]);
+        before = me[1];
+    }
+    int delta = 0;
+    for(int j=0; j<lanes; ++j)
+        delta += diff[j];
+
+    // the remaining sites one at a time
+    if((row + col) % 2 != phase)
+        ++col;
+    return delta + update_pair_sites_scalar<T>(pair, row, col, bits);
+}
+#endif
+
+#endif
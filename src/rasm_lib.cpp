@@ -5,20 +5,261 @@
 #include <climits>
 #include <cstdio>
 #include <cstring>
+#include <cstdint>
 #include <random>
+#include <new>
+#include <utility>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <map>
+#include <chrono>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/file.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <errno.h>
 #include "rasm_lib.h"
+#include "rasm_kernel.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-// global variables needed for random number generation
+// Allocates an n_rows x n_cols height function, rows padded to 64 bytes
+HeightField::HeightField(const int n_rows, const int n_cols, const int width)
+    : data_(NULL), capacity_(0), n_rows_(0), n_cols_(0), stride_(0),
+      width_(width) {
+    resize(n_rows, n_cols, width);
+}
+
+HeightField::HeightField()
+    : data_(NULL), capacity_(0), n_rows_(0), n_cols_(0), stride_(0),
+      width_(4) {}
+
+HeightField::HeightField(const HeightField &other)
+    : HeightField(other.n_rows_, other.n_cols_, other.width_) {
+    std::memcpy(data_, other.data_,
+                (std::size_t) width_ * n_rows_ * stride_);
+}
+
+HeightField::HeightField(HeightField &&other) noexcept
+    : data_(other.data_), capacity_(other.capacity_), n_rows_(other.n_rows_),
+      n_cols_(other.n_cols_), stride_(other.stride_), width_(other.width_) {
+    other.data_ = NULL;
+    other.capacity_ = 0;
+    other.n_rows_ = other.n_cols_ = other.stride_ = 0;
+}
+
+// copy and swap: other is already a copy (or a moved-from temporary)
+HeightField &HeightField::operator=(HeightField other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(capacity_, other.capacity_);
+    std::swap(n_rows_, other.n_rows_);
+    std::swap(n_cols_, other.n_cols_);
+    std::swap(stride_, other.stride_);
+    std::swap(width_, other.width_);
+    return *this;
+}
+
+// Reshapes to n_rows x n_cols, only allocating if the buffer is too small
+void HeightField::resize(const int n_rows, const int n_cols, const int width) {
+    if(data_ != NULL && n_rows == n_rows_ && n_cols == n_cols_ &&
+       width == width_)
+        return;
+    const int stride = (n_cols + 64/width - 1) & ~(64/width - 1);
+    std::size_t bytes = (std::size_t) width * n_rows * stride;
+    if(data_ == NULL || bytes > capacity_) {
+        std::free(data_);
+        // aligned_alloc wants a size that is a multiple of the alignment
+        capacity_ = bytes ? (bytes + 63) & ~(std::size_t) 63 : 64;
+        data_ = (char *) std::aligned_alloc(64, capacity_);
+        if(data_ == NULL) {
+            capacity_ = 0;
+            n_rows_ = n_cols_ = stride_ = 0;
+            throw std::bad_alloc();
+        }
+    }
+    n_rows_ = n_rows;
+    n_cols_ = n_cols;
+    stride_ = stride;
+    width_ = width;
+    std::memset(data_, 0, bytes);
+}
+
+HeightField::~HeightField() {
+    std::free(data_);
+}
+
+// Interleaves the rows of a min and a max into a pair, entries of type T
+template<typename T>
+static void pack_rows(HeightPair &pair, const HeightField &minimum_ht,
+                      const HeightField &maximum_ht) {
+    for(int row=0; row<pair.n_rows(); ++row) {
+        T *pairs = pair.row<T>(row);
+        const T *min = minimum_ht.row<T>(row), *max = maximum_ht.row<T>(row);
+        for(int col=0; col<pair.n_cols(); ++col) {
+            pairs[2 * col] = min[col];
+            pairs[2 * col + 1] = max[col];
+        }
+    }
+}
+
+// Splits the rows of a pair into a min and a max, entries of type T
+template<typename T>
+static void unpack_rows(const HeightPair &pair, HeightField &minimum_ht,
+                        HeightField &maximum_ht) {
+    for(int row=0; row<pair.n_rows(); ++row) {
+        const T *pairs = pair.row<T>(row);
+        T *min = minimum_ht.row<T>(row), *max = maximum_ht.row<T>(row);
+        for(int col=0; col<pair.n_cols(); ++col) {
+            min[col] = pairs[2 * col];
+            max[col] = pairs[2 * col + 1];
+        }
+    }
+}
+
+void HeightPair::pack(const HeightField &minimum_ht,
+                      const HeightField &maximum_ht) {
+    resize(minimum_ht.n_rows(), minimum_ht.n_cols(), minimum_ht.width());
+    if(width() == 1)
+        pack_rows<int8_t>(*this, minimum_ht, maximum_ht);
+    else if(width() == 2)
+        pack_rows<int16_t>(*this, minimum_ht, maximum_ht);
+    else
+        pack_rows<int>(*this, minimum_ht, maximum_ht);
+}
+
+void HeightPair::unpack(HeightField &minimum_ht, HeightField &maximum_ht) const {
+    minimum_ht.resize(n_rows(), n_cols(), width());
+    maximum_ht.resize(n_rows(), n_cols(), width());
+    if(width() == 1)
+        unpack_rows<int8_t>(*this, minimum_ht, maximum_ht);
+    else if(width() == 2)
+        unpack_rows<int16_t>(*this, minimum_ht, maximum_ht);
+    else
+        unpack_rows<int>(*this, minimum_ht, maximum_ht);
+}
+
+// Heights are between 1 and max_height, and a masked-out SIMD lane may
+// hold a neighbour +- 1, so leave one value of headroom
+int ht_width(const int max_height) {
+    if(max_height < INT8_MAX)
+        return 1;
+    if(max_height < INT16_MAX)
+        return 2;
+    return 4;
+}
+
+PhaseTimer::PhaseTimer() : phase_(N_PHASES), cpu_start_(0) {
+    for(int phase=0; phase<N_PHASES; ++phase)
+        wall_[phase] = cpu_[phase] = 0;
+}
+
+void PhaseTimer::enter(const Phase phase) {
+    const std::chrono::steady_clock::time_point wall_now = std::chrono::steady_clock::now();
+    const std::clock_t cpu_now = std::clock();
+    if(phase_ != N_PHASES) {
+        wall_[phase_] += std::chrono::duration<double>(wall_now - wall_start_).count();
+        cpu_[phase_] += (double) (cpu_now - cpu_start_) / CLOCKS_PER_SEC;
+    }
+    phase_ = phase;
+    wall_start_ = wall_now;
+    cpu_start_ = cpu_now;
+}
+
+void PhaseTimer::stop() {
+    enter(N_PHASES);
+}
+
+// A phase in progress counts up to now
+double PhaseTimer::wall(const Phase phase) const {
+    if(phase != phase_)
+        return wall_[phase];
+    return wall_[phase] + std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - wall_start_).count();
+}
+
+double PhaseTimer::cpu(const Phase phase) const {
+    if(phase != phase_)
+        return cpu_[phase];
+    return cpu_[phase] + (double) (std::clock() - cpu_start_) / CLOCKS_PER_SEC;
+}
+
+double PhaseTimer::wall() const {
+    double total = 0;
+    for(int phase=0; phase<N_PHASES; ++phase)
+        total += wall((Phase) phase);
+    return total;
+}
+
+double PhaseTimer::cpu() const {
+    double total = 0;
+    for(int phase=0; phase<N_PHASES; ++phase)
+        total += cpu((Phase) phase);
+    return total;
+}
+
+const char *PhaseTimer::name(const Phase phase) {
+    static const char *names[N_PHASES] = {"initialization", "sampling",
+                                          "checks", "output"};
+    return phase < N_PHASES ? names[phase] : "none";
+}
+
+CftpSampler::CftpSampler() : rng_(std::random_device()()) {}
+
+CftpSampler::CftpSampler(const int seed) : rng_(seed) {}
 
-// holds the last random number generated
-int last_rand;
-// holds the offset (which bit of last_rand) is being read
-int offset; // at most 32 for 32-bit code
+// Samples with the next random seed, the ASM goes to entries
+int CftpSampler::sample(const int order, int8_t *entries, const int initial) {
+    std::uniform_int_distribution<> dist(-INT_MAX-1, INT_MAX);
+    const int random_seed = dist(rng_);
+    sample_seeded(order, random_seed, initial);
+    asm_entries(maximum_ht_, entries);
+    return random_seed;
+}
+
+// Samples with the given random seed, reusing the height functions
+int CftpSampler::sample_seeded(const int order, const int random_seed,
+                               int initial, const int report,
+                               PhaseTimer *timer) {
+    // note height matrix is 1 bigger in each dimension than the desired ASM
+    const int n_rows = order + 1, n_cols = order + 1;
+    if(order < 1)
+        throw std::invalid_argument("invalid order " + std::to_string(order));
+    if(1 << log2_int(initial) != initial)
+        initial = (1 << log2_int(initial));
+
+    const PhaseTimer::Phase outer = timer != NULL ? timer->phase()
+                                                  : PhaseTimer::N_PHASES;
+    if(timer != NULL)
+        timer->enter(PhaseTimer::INITIALIZATION);
+    minimum_ht_.resize(n_rows, n_cols, ht_width(n_rows));
+    maximum_ht_.resize(n_rows, n_cols, ht_width(n_rows));
+    cftp_seeds(random_seed, seeds_);
+    initialize_ht(minimum_ht_, maximum_ht_);
+    const int steps = run_cftp(minimum_ht_, maximum_ht_, seeds_, initial,
+                               report, false, NULL, NULL, NULL, timer);
+    if(timer != NULL)
+        timer->enter(outer);
+    return steps;
+}
 
 // Samples the random alternating sign matrix (ASM)
-int **sample_asm(const int order, int initial=128, const bool verbose=false) {
+HeightField sample_asm(const int order, int initial=128,
+                       const bool verbose=false) {
     // declare variables
-    int count;
     int seeds[256]; // seeds for coupling from the past
     int random_seed; // random seed
     // note height matrix is 1 bigger in each dimension than the desired ASM
@@ -36,50 +277,250 @@ int **sample_asm(const int order, int initial=128, const bool verbose=false) {
     if(order < 1) {
         std::cerr << "Invalid order " << order << std::endl;
         //exit(1);
-        return NULL;
+        return HeightField();
     }
 
-    // declare the min and max height functions
-    // TODO(dan): smart pointers
-
-    int **minimum_ht = new int*[n_rows];
-    int **maximum_ht = new int*[n_rows];
-    for(int i=0; i<n_rows; ++i) {
-        minimum_ht[i] = new int[n_cols];
-        maximum_ht[i] = new int[n_cols];
-    }
+    // declare the min and max height functions, with the narrowest
+    // entries that can hold heights up to n_rows
+    HeightField minimum_ht(n_rows, n_cols, ht_width(n_rows));
+    HeightField maximum_ht(n_rows, n_cols, ht_width(n_rows));
 
     // create a random seed to be used just below
     std::random_device rd; // use to seed the rng
     RNG rng0(rd()); // rng
     std::uniform_int_distribution<> dist0(-INT_MAX-1, INT_MAX);
     random_seed = dist0(rng0);
+    cftp_seeds(random_seed, seeds);
+
+    // run coupling from the past (it loops while min and max differ)
+    initialize_ht(minimum_ht, maximum_ht);
+    run_cftp(minimum_ht, maximum_ht, seeds, initial, verbose, false);
+
+    // done, now return maximum_ht (minimum_ht is freed on return)
+    return maximum_ht;
+}
 
+// Gets the 256 seeds of the coupling from the past epochs
+void cftp_seeds(const int random_seed, int seeds[256]) {
     // initialize the random number generator used throughout
     // note: as soon as the main loop starts running, it will be reinitialized
     // this initialization is then only used to generate 256 random seeds used
     // in the coupling from the past construction down the line
     RNG rn_gen(random_seed);
-    offset = 32; // technically not needed here
 
     // get 256 seeds, to be used by the random number generator in the
     // coupling from the past main loop
-    for(count=0; count<256; ++count) {
+    for(int count=0; count<256; ++count) {
         std::uniform_int_distribution<> dist(-INT_MAX-1, INT_MAX);
         seeds[count] = dist(rn_gen);
     }
+}
 
-    // run coupling from the past
-    run_cftp(minimum_ht, maximum_ht, n_rows, n_cols, rn_gen,
-             seeds, initial, verbose, false);
+// The random seed of sample index of a batch: a Philox block keyed by the
+// batch seed, so it depends on nothing but (seed, index)
+int batch_seed(const int seed, const int index) {
+    const uint32_t key[2] = {(uint32_t) seed, 0xBA7C4ED5u};
+    uint32_t ctr[4] = {(uint32_t) index, 0, 0, 0};
+    philox4x32(ctr, key);
+    return (int) ctr[0];
+}
 
-    // deallocate memory for minimum_ht
-    for(int i = 0; i < n_rows; ++i)
-        delete [] minimum_ht[i];
-    delete [] minimum_ht;
+// Samples count ASMs on a pool of threads, each thread taking the next
+// sample not yet started, so a slow coupling doesn't hold up the others;
+// each sample is added to the thread's own copy of accumulator (if not
+// NULL, the copies are merged into it at the end) and then passed to
+// callback (if set)
+static void run_batch(const int order, const int count, const int initial,
+                      const int seed, int threads, Accumulator *accumulator,
+                      const BatchCallback &callback) {
+    if(order < 1) {
+        std::cerr << "Invalid order " << order << std::endl;
+        return;
+    }
+    if(threads < 1)
+        threads = std::max(1, (int) std::thread::hardware_concurrency());
+    threads = std::min(threads, count);
 
-    // done, now return maximum_ht
-    return maximum_ht;
+    std::atomic<int> next(0);
+    std::mutex callback_mutex;
+    auto worker = [&]() {
+#ifdef _OPENMP
+        // the samples are the parallelism, don't split sweeps as well (the
+        // setting is per thread; the calling thread gets its own back)
+        const int omp_threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+#endif
+        // one sampler per thread, its height functions reused by its samples
+        CftpSampler sampler(seed);
+        Accumulator sums(accumulator != NULL ? accumulator->observables()
+                                             : std::vector<Observable>());
+        for(int index=next++; index<count; index=next++) {
+            const int random_seed = batch_seed(seed, index);
+            const int steps = sampler.sample_seeded(order, random_seed, initial);
+            if(accumulator != NULL)
+                sums.add(sampler.height());
+            if(callback) {
+                std::lock_guard<std::mutex> lock(callback_mutex);
+                callback(index, random_seed, steps, sampler.height());
+            }
+        }
+        if(accumulator != NULL) {
+            std::lock_guard<std::mutex> lock(callback_mutex);
+            accumulator->merge(sums);
+        }
+#ifdef _OPENMP
+        omp_set_num_threads(omp_threads);
+#endif
+    };
+
+    std::vector<std::thread> pool;
+    for(int t=1; t<threads; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for(std::thread &thread : pool)
+        thread.join();
+}
+
+void sample_asm_batch(const int order, const int count, const int initial,
+                      const int seed, const int threads,
+                      const BatchCallback &callback) {
+    run_batch(order, count, initial, seed, threads, NULL, callback);
+}
+
+void sample_asm_batch(const int order, const int count, const int initial,
+                      const int seed, const int threads,
+                      Accumulator &accumulator, const BatchCallback &callback) {
+    run_batch(order, count, initial, seed, threads, &accumulator, callback);
+}
+
+// Samples count ASMs, returned in the order of their index
+std::vector<HeightField> sample_asm_batch(const int order, const int count,
+                                          const int initial, const int seed,
+                                          const int threads) {
+    std::vector<HeightField> samples(std::max(count, 0));
+    sample_asm_batch(order, count, initial, seed, threads,
+                     [&](const int index, const int, const int,
+                         const HeightField &ht) {
+                         samples[index] = ht;
+                     });
+    return samples;
+}
+
+// Samples count ASMs straight into entries, sample index at its offset
+void sample_asm_batch(const int order, const int count, const int initial,
+                      const int seed, const int threads, int8_t *entries) {
+    sample_asm_batch(order, count, initial, seed, threads,
+                     [&](const int index, const int, const int,
+                         const HeightField &ht) {
+                         asm_entries(ht, entries + (long) index * order * order);
+                     });
+}
+
+// Reads the cache of coalescence times: counts[order][steps]
+static std::map<int, std::map<int, int> > read_coalescence(const char *path) {
+    std::map<int, std::map<int, int> > counts;
+    std::ifstream in(path);
+    int order, steps, count;
+    while(in >> order >> steps >> count)
+        if(order > 0 && steps > 0 && count > 0)
+            counts[order][steps] += count;
+    return counts;
+}
+
+// The median of the recorded coalescence times of an order, scaled from the
+// nearest smaller order when there are none (coalescence takes more than
+// order^2 steps, so the scaled guess errs on the short side, which only
+// costs a doubling, while starting too long costs the whole excess)
+int learned_initial(const char *path, const int order) {
+    std::map<int, std::map<int, int> > counts = read_coalescence(path);
+    std::map<int, std::map<int, int> >::iterator known = counts.upper_bound(order);
+    if(known == counts.begin())
+        return 0;
+    --known;
+
+    int total = 0, seen = 0, median = 0;
+    for(const auto &entry : known->second)
+        total += entry.second;
+    for(const auto &entry : known->second) {
+        seen += entry.second;
+        if(2 * seen >= total) {
+            median = entry.first;
+            break;
+        }
+    }
+    if(known->first == order)
+        return median;
+    double scaled = (double) median * order * order
+                    / ((double) known->first * known->first);
+    if(scaled >= (1 << 29))
+        return 1 << 29;
+    int initial = 1;
+    while(2 * initial <= scaled)
+        initial *= 2;
+    return initial;
+}
+
+// Adds to the cache, written to a temporary file first so that a reader
+// never sees it half done, under a lock so that no writer's update is lost
+bool record_coalescence(const char *path, const int order, const int steps,
+                        const int count, const int initial) {
+    if(order < 1 || steps < 1 || count < 1)
+        return true;
+    // coalesced in the first run: all that is known is steps <= initial
+    const int recorded = steps <= initial ? std::max(1, initial / 2) : steps;
+    // the lock is a file of its own, the cache being replaced by renaming
+    const std::string lock = std::string(path) + ".lock";
+    const int lock_fd = open(lock.c_str(), O_RDWR | O_CREAT, 0644);
+    if(lock_fd < 0)
+        return false;
+    while(flock(lock_fd, LOCK_EX) != 0)
+        if(errno != EINTR) {
+            close(lock_fd);
+            return false;
+        }
+    std::map<int, std::map<int, int> > counts = read_coalescence(path);
+    counts[order][recorded] += count;
+
+    // a temporary file of this process's own (runs sharing the cache would
+    // otherwise write the same one, and rename each other's half of it)
+    std::string tmp = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream out(tmp.c_str());
+        for(const auto &by_order : counts)
+            for(const auto &entry : by_order.second)
+                out << by_order.first << " " << entry.first << " "
+                    << entry.second << "\n";
+        if(!out) {
+            std::remove(tmp.c_str());
+            close(lock_fd);
+            return false;
+        }
+    }
+    const bool renamed = std::rename(tmp.c_str(), path) == 0;
+    close(lock_fd); // and with it the lock
+    return renamed;
+}
+
+// Reads the ASM off the height function, entries of type T
+template<typename T>
+static void asm_rows(const HeightField &matrix_ht, int8_t *entries) {
+    const int order = matrix_ht.n_rows() - 1;
+    for(int row=1; row<=order; ++row) {
+        const T *up = matrix_ht.row<T>(row-1), *cur = matrix_ht.row<T>(row);
+        int8_t *out = entries + (long) (row - 1) * order;
+        for(int col=1; col<=order; ++col)
+            out[col-1] = (up[col] + cur[col-1] - cur[col] - up[col-1]) / 2;
+    }
+}
+
+// Computes the ASM of a height function
+void asm_entries(const HeightField &matrix_ht, int8_t *entries) {
+    if(matrix_ht.width() == 1)
+        asm_rows<int8_t>(matrix_ht, entries);
+    else if(matrix_ht.width() == 2)
+        asm_rows<int16_t>(matrix_ht, entries);
+    else
+        asm_rows<int>(matrix_ht, entries);
 }
 
 // Computes (int) ceil(log2(x))
@@ -96,154 +537,1775 @@ int log2_int(int x) {
 }
 
 // Checks whether (row, col) position in matrix_ht can be flipped 
-inline bool is_extreme(int **matrix_ht, const int row, const int col) {
-    return (matrix_ht[row-1][col] == matrix_ht[row][col+1] &&
-            matrix_ht[row][col+1] == matrix_ht[row+1][col] &&
-            matrix_ht[row+1][col] == matrix_ht[row][col-1]);
+bool is_extreme(const HeightField &matrix_ht, const int row, const int col) {
+    return (matrix_ht.get(row-1, col) == matrix_ht.get(row, col+1) &&
+            matrix_ht.get(row, col+1) == matrix_ht.get(row+1, col) &&
+            matrix_ht.get(row+1, col) == matrix_ht.get(row, col-1));
 }
 
-// Initializes max and min height functions
-void initialize_ht(int **minimum_ht, int **maximum_ht, const int n_rows,
-                   const int n_cols) {
+// Initializes max and min height functions with entries of type T, the
+// domain wall boundary of a square (both are symmetric)
+template<typename T>
+static void initialize_rows(HeightField &minimum_ht, HeightField &maximum_ht) {
+    const int n_rows = minimum_ht.n_rows();
     int row, col;
-    int value;
+    T value;
     for(row=0; row<n_rows; ++row) {
+        T *min_row = minimum_ht.row<T>(row), *max_row = maximum_ht.row<T>(row);
         /* for(col=0; col<n_cols; ++col)
-            minimum_ht[row][col] = std::abs((int) (row - col)) + 1;*/
-        // Optimization assuming a square matrix
+            min_row[col] = std::abs((int) (row - col)) + 1;*/
+        // Optimization for a square matrix, see initialize_ht for others
         for(col=0; col<row; ++col) {
-            minimum_ht[row][col] = (row - col) + 1;
-            minimum_ht[col][row] = (row - col) + 1;
+            min_row[col] = (row - col) + 1;
+            minimum_ht.row<T>(col)[row] = (row - col) + 1;
 
-            // TODO: change to allow for rectangular matrices
-            // for now this assumes n_rows = n_cols
             value = n_rows - std::abs((int) (n_rows - col - row - 1));
-            maximum_ht[row][col] = value;
-            maximum_ht[col][row] = value;
+            max_row[col] = value;
+            maximum_ht.row<T>(col)[row] = value;
         }
-        minimum_ht[row][row] = 1;
-        maximum_ht[row][row] = n_rows - std::abs((int) (n_rows - 2*row - 1));
+        min_row[row] = 1;
+        max_row[row] = n_rows - std::abs((int) (n_rows - 2*row - 1));
     }
 }
 
-// Computes the difference between max and min height functions.
-// This function could be eliminated by having this as a variable
-// and modifying it in evolve_ht(). However, this is not
-// called very often, so it doesn't contribute much to the timings.
-int volume_diff(int **minimum_ht, int **maximum_ht, const int n_rows,
-                const int n_cols) {
-    int diff = 0;
+// Whether the boundary of the height function is the domain wall one,
+// |row - col| + 1, of a square
+template<typename T>
+static bool domain_wall_square(const HeightField &matrix_ht) {
+    const int n = matrix_ht.n_rows();
+    if(matrix_ht.n_cols() != n)
+        return false;
+    const T *top = matrix_ht.row<T>(0), *bottom = matrix_ht.row<T>(n-1);
+    for(int k=0; k<n; ++k)
+        if(top[k] != k + 1 || bottom[k] != n - k ||
+           matrix_ht.row<T>(k)[0] != k + 1 || matrix_ht.row<T>(k)[n-1] != n - k)
+            return false;
+    return true;
+}
+
+// Lowers (Sign = -1: raises) every entry of f, a rows x cols array, to the
+// best of f(other) + Sign * distance(other, here) over the other entries,
+// distances being those of the grid (|row - row'| + |col - col'|). That
+// is separable, a pass along the rows both ways and then along the columns
+// both ways does it.
+template<int Sign>
+static void envelope(std::vector<int> &f, const int rows, const int cols) {
+    // better: lower for the max (Sign = 1), higher for the min
+    auto better = [](const int a, const int b) { return Sign > 0 ? std::min(a, b)
+                                                                 : std::max(a, b); };
+    for(int row=0; row<rows; ++row) {
+        int *r = &f[(std::size_t) row * cols];
+        for(int col=1; col<cols; ++col)
+            r[col] = better(r[col], r[col-1] + Sign);
+        for(int col=cols-2; col>=0; --col)
+            r[col] = better(r[col], r[col+1] + Sign);
+    }
+    for(int row=1; row<rows; ++row)
+        for(int col=0; col<cols; ++col)
+            f[(std::size_t) row * cols + col] =
+                better(f[(std::size_t) row * cols + col],
+                       f[(std::size_t) (row-1) * cols + col] + Sign);
+    for(int row=rows-2; row>=0; --row)
+        for(int col=0; col<cols; ++col)
+            f[(std::size_t) row * cols + col] =
+                better(f[(std::size_t) row * cols + col],
+                       f[(std::size_t) (row+1) * cols + col] + Sign);
+}
+
+// The lowest and highest height functions with the boundary of minimum_ht:
+// the highest of boundary - distance to it, and the lowest of boundary +
+// distance to it, which agree with the boundary on it if it is a possible
+// one. Returns false if it isn't, or if the heights don't fit in T.
+template<typename T>
+static bool initialize_boundary_rows(HeightField &minimum_ht,
+                                     HeightField &maximum_ht) {
+    const int n_rows = minimum_ht.n_rows(), n_cols = minimum_ht.n_cols();
+    if(domain_wall_square<T>(minimum_ht)) {
+        initialize_rows<T>(minimum_ht, maximum_ht);
+        return true;
+    }
+
+    // far enough out of the range of heights for any boundary in T
+    const int far = 1 << 30;
+    std::vector<int> low((std::size_t) n_rows * n_cols, -far);
+    std::vector<int> high((std::size_t) n_rows * n_cols, far);
+    auto on_boundary = [&](const int row, const int col) {
+        return row == 0 || row == n_rows - 1 || col == 0 || col == n_cols - 1;
+    };
+    for(int row=0; row<n_rows; ++row)
+        for(int col=0; col<n_cols; ++col)
+            if(on_boundary(row, col))
+                low[(std::size_t) row * n_cols + col] =
+                    high[(std::size_t) row * n_cols + col] = minimum_ht.row<T>(row)[col];
+    envelope<-1>(low, n_rows, n_cols);
+    envelope<1>(high, n_rows, n_cols);
+
     for(int row=0; row<n_rows; ++row) {
+        T *min_row = minimum_ht.row<T>(row), *max_row = maximum_ht.row<T>(row);
+        for(int col=0; col<n_cols; ++col) {
+            const int min_value = low[(std::size_t) row * n_cols + col];
+            const int max_value = high[(std::size_t) row * n_cols + col];
+            if(on_boundary(row, col)) {
+                // neighbours on the boundary differ by exactly 1, and no two
+                // boundary heights are further apart than their distance
+                if(min_value != min_row[col] || max_value != min_row[col] ||
+                   ((row == 0 || row == n_rows - 1) && col > 0 &&
+                    std::abs(min_row[col] - min_row[col-1]) != 1) ||
+                   (row > 0 && (col == 0 || col == n_cols - 1) &&
+                    std::abs(min_row[col] - minimum_ht.row<T>(row-1)[col]) != 1))
+                    return false;
+            }
+            else if(min_value < std::numeric_limits<T>::min() ||
+                    max_value > std::numeric_limits<T>::max())
+                return false;
+            min_row[col] = min_value;
+            max_row[col] = max_value;
+        }
+    }
+    return true;
+}
+
+// Initializes max and min height functions with the boundary (of ASMs)
+// |row - col| + 1: for a square the domain wall boundary, for others the
+// corner sums of the partial identity matrix along the boundary
+void initialize_ht(HeightField &minimum_ht, HeightField &maximum_ht) {
+    const int n_rows = minimum_ht.n_rows(), n_cols = minimum_ht.n_cols();
+    if(n_rows != n_cols) {
+        for(int row=0; row<n_rows; ++row)
+            for(int col=0; col<n_cols; ++col)
+                if(row == 0 || row == n_rows - 1 || col == 0 || col == n_cols - 1)
+                    minimum_ht.set(row, col, std::abs(row - col) + 1);
+        initialize_ht_boundary(minimum_ht, maximum_ht);
+    }
+    else if(minimum_ht.width() == 1)
+        initialize_rows<int8_t>(minimum_ht, maximum_ht);
+    else if(minimum_ht.width() == 2)
+        initialize_rows<int16_t>(minimum_ht, maximum_ht);
+    else
+        initialize_rows<int>(minimum_ht, maximum_ht);
+}
+
+// Initializes max and min height functions with the boundary of minimum_ht
+void initialize_ht_boundary(HeightField &minimum_ht, HeightField &maximum_ht) {
+    bool possible;
+    if(minimum_ht.width() == 1)
+        possible = initialize_boundary_rows<int8_t>(minimum_ht, maximum_ht);
+    else if(minimum_ht.width() == 2)
+        possible = initialize_boundary_rows<int16_t>(minimum_ht, maximum_ht);
+    else
+        possible = initialize_boundary_rows<int>(minimum_ht, maximum_ht);
+    if(!possible)
+        throw std::invalid_argument("no height function has this boundary, "
+                                    "or its heights don't fit in its width");
+}
+
+// Initializes the min and max of a pair with entries of type T, the
+// domain wall boundary of a square (see initialize_rows)
+template<typename T>
+static void initialize_pair_rows(HeightPair &pair) {
+    const int n = pair.n_rows();
+    for(int row=0; row<n; ++row) {
+        T *pairs = pair.row<T>(row);
+        for(int col=0; col<n; ++col) {
+            pairs[2 * col] = std::abs(row - col) + 1;
+            pairs[2 * col + 1] = n - std::abs(n - col - row - 1);
+        }
+    }
+}
+
+// Initializes the min and max of a pair, for a square directly and for
+// others through initialize_ht
+void initialize_ht(HeightPair &pair) {
+    if(pair.n_rows() != pair.n_cols()) {
+        HeightField minimum_ht(pair.n_rows(), pair.n_cols(), pair.width());
+        HeightField maximum_ht(pair.n_rows(), pair.n_cols(), pair.width());
+        initialize_ht(minimum_ht, maximum_ht);
+        pair.pack(minimum_ht, maximum_ht);
+    }
+    else if(pair.width() == 1)
+        initialize_pair_rows<int8_t>(pair);
+    else if(pair.width() == 2)
+        initialize_pair_rows<int16_t>(pair);
+    else
+        initialize_pair_rows<int>(pair);
+}
+
+// Sums max - min over the sites of a pair, entries of type T
+template<typename T>
+static long long volume_pair_rows(const HeightPair &pair) {
+    long long volume = 0;
+    const int n_cols = pair.n_cols();
+    for(int row=0; row<pair.n_rows(); ++row) {
+        const T *pairs = pair.row<T>(row);
+        int row_volume = 0;
         for(int col=0; col<n_cols; ++col)
-        diff += (maximum_ht[row][col] - minimum_ht[row][col]);
+            row_volume += pairs[2 * col + 1] - pairs[2 * col];
+        volume += row_volume;
+    }
+    return volume;
+}
+
+long long volume_diff(const HeightPair &pair) {
+    if(pair.width() == 1)
+        return volume_pair_rows<int8_t>(pair);
+    if(pair.width() == 2)
+        return volume_pair_rows<int16_t>(pair);
+    return volume_pair_rows<int>(pair);
+}
+
+// Sums max - min over the sites, entries of type T
+template<typename T>
+static long long volume_diff_rows(const HeightField &minimum_ht,
+                                  const HeightField &maximum_ht) {
+    long long diff = 0;
+    for(int row=0; row<minimum_ht.n_rows(); ++row) {
+        const T *min_row = minimum_ht.row<T>(row);
+        const T *max_row = maximum_ht.row<T>(row);
+        for(int col=0; col<minimum_ht.n_cols(); ++col)
+            diff += (max_row[col] - min_row[col]);
     }
     return diff;
 }
 
-// int random_pm1(RNG& rn_gen){
-//     std::bernoulli_distribution dist(0.5);
-//     int coin_flip = dist(rn_gen) ? 1 : -1;
-//     // std::cout << "generated " << coin_flip << std::endl;
-//     return coin_flip;
-// }
+// Computes the difference between max and min height functions.
+// run_cftp only calls this once, afterwards it keeps the difference
+// up to date with the changes returned by evolve_ht().
+long long volume_diff(const HeightField &minimum_ht, const HeightField &maximum_ht) {
+    if(minimum_ht.width() == 1)
+        return volume_diff_rows<int8_t>(minimum_ht, maximum_ht);
+    if(minimum_ht.width() == 2)
+        return volume_diff_rows<int16_t>(minimum_ht, maximum_ht);
+    return volume_diff_rows<int>(minimum_ht, maximum_ht);
+}
 
-// Generates a 32 bit random uint and then reads off its bits one
-// by one for faster speed
-short random_pm1(RNG& rn_gen) {
-    if(offset == 32) {
-        std::uniform_int_distribution<unsigned int> dist(0, UINT_MAX);
-        last_rand = dist(rn_gen);
-        offset = 0;
+// One Philox4x32 round: two 32x32->64 bit multiplications and a key xor
+static inline void philox_round(uint32_t ctr[4], const uint32_t key[2]) {
+    uint64_t p0 = (uint64_t) 0xD2511F53u * ctr[0];
+    uint64_t p1 = (uint64_t) 0xCD9E8D57u * ctr[2];
+    uint32_t c0 = (uint32_t) (p1 >> 32) ^ ctr[1] ^ key[0];
+    uint32_t c2 = (uint32_t) (p0 >> 32) ^ ctr[3] ^ key[1];
+    ctr[1] = (uint32_t) p1;
+    ctr[3] = (uint32_t) p0;
+    ctr[0] = c0;
+    ctr[2] = c2;
+}
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as
+// 1, 2, 3"): 128 random bits as a function of a 128 bit counter and a
+// 64 bit key, no state carried between calls
+void philox4x32(uint32_t ctr[4], const uint32_t seed_key[2]) {
+    uint32_t key[2] = {seed_key[0], seed_key[1]};
+    for(int round=0; round<10; ++round) {
+        philox_round(ctr, key);
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
     }
-    // read off the individual bits and increase the offset for next read
-    return (last_rand & (1 << offset++)) ? 1 : -1;
 }
 
-// Evolves the min and max height functions according to the
-// monotone coupling from the past dynamics
-void evolve_ht(int **minimum_ht, int **maximum_ht,
-               const int n_rows, const int n_cols, RNG& rn_gen) {
+// Fills bits with the coin flips of all the sites of a row at a given
+// time step: the counter is (step, row, block of 128 columns) and the key
+// is the seed of the epoch, so a site's coin depends on nothing else
+void row_coins(const int seed, const long long step, const int row,
+               const int n_cols, uint32_t *bits) {
+    const uint32_t key[2] = {(uint32_t) seed, 0x5A17A5A1u};
+    for(int block=0; 128*block<n_cols; ++block) {
+        uint32_t ctr[4] = {(uint32_t) step, (uint32_t) (step >> 32),
+                           (uint32_t) row, (uint32_t) block};
+        philox4x32(ctr, key);
+        // n_cols rounded up to a multiple of 128 bits is always allocated
+        std::memcpy(bits + 4*block, ctr, sizeof(ctr));
+    }
+}
+
+typedef int (*row_kernel)(HeightField &, HeightField &, const int,
+                          const int, const uint32_t *, int *);
 
-    short coin_flip;
+// whether evolve_ht uses the AVX2 kernels, decided on first use
+static bool &use_avx2() {
+#ifdef RASM_HAVE_AVX2
+    static bool avx2 = __builtin_cpu_supports("avx2");
+#else
+    static bool avx2 = false;
+#endif
+    return avx2;
+}
+
+// The row kernel for entries of type T, updating both height functions
+// or (Both = false) only the max of a coalesced row, and counting the
+// flips or not
+template<typename T, bool Both, bool Count>
+static row_kernel select_kernel() {
+#ifdef RASM_HAVE_AVX2
+    if(use_avx2())
+        return update_row_avx2<T, Both, Count>;
+#endif
+    return update_row_scalar<T, Both, Count>;
+}
+
+// Chooses the kernel by name, "auto" picks the best one the CPU supports
+bool set_evolve_kernel(const char *name) {
+    if(!std::strcmp(name, "scalar"))
+        use_avx2() = false;
+#ifdef RASM_HAVE_AVX2
+    else if(!std::strcmp(name, "avx2") && __builtin_cpu_supports("avx2"))
+        use_avx2() = true;
+    else if(!std::strcmp(name, "auto"))
+        use_avx2() = __builtin_cpu_supports("avx2");
+#else
+    else if(!std::strcmp(name, "auto"))
+        use_avx2() = false;
+#endif
+    else
+        return false;
+    return true;
+}
+
+// Returns the name of the kernel used by evolve_ht
+const char *evolve_kernel_name() {
+    return use_avx2() ? "avx2" : "scalar";
+}
+
+// The first and last rows where min and max differ. Late in an epoch most
+// rows have coalesced, and scanning for the ones that haven't stops at the
+// first difference from either end (evolving a single height function,
+// passed as both, there's no need). If none do, they are put further than
+// reach from every row, reach being how far the difference can spread.
+template<typename T>
+static void differing_rows(const HeightField &minimum_ht,
+                           const HeightField &maximum_ht, const int reach,
+                           int &first, int &last) {
+    const int n_rows = minimum_ht.n_rows();
+    const std::size_t row_bytes = (std::size_t) minimum_ht.n_cols() * sizeof(T);
+    first = &minimum_ht == &maximum_ht ? n_rows : 0;
+    last = n_rows - 1;
+    while(first < n_rows && !std::memcmp(minimum_ht.row<T>(first),
+                                         maximum_ht.row<T>(first), row_bytes))
+        ++first;
+    while(last > first && !std::memcmp(minimum_ht.row<T>(last),
+                                       maximum_ht.row<T>(last), row_bytes))
+        --last;
+    if(first == n_rows) {
+        // all coalesced, keep every row out of reach
+        first = n_rows + reach;
+        last = -1 - reach;
+    }
+}
+
+// Sweeps both phases over the rows, entries of type T, counting the
+// flips into flips if Count; row 0 is row first_row of the whole height
+// function, which the coins and the phases go by
+template<typename T, bool Count>
+static long long evolve_rows(HeightField &minimum_ht, HeightField &maximum_ht,
+                             const int seed, const long long step,
+                             FlipCounts *flips, const int first_row) {
+
+    const int n_rows = minimum_ht.n_rows(), n_cols = minimum_ht.n_cols();
+    // the coin of site (row, col) is bit col%32 of word col/32 of the row's
+    // coins, so it doesn't depend on the order in which the sites are visited
+    const int n_words = coin_words(n_cols);
+    const row_kernel kernel = select_kernel<T, true, Count>();
+    const row_kernel coalesced_kernel = select_kernel<T, false, Count>();
+    long long delta = 0, min_flips = 0, max_flips = 0;
+
+    // the rows where min and max differ are between first and last; a
+    // phase can spread the difference by one row, so a row needs both
+    // height functions updated if it is within 1 + phase of these, and
+    // elsewhere the two agree and only the max is worked out
+    int first, last;
+    differing_rows<T>(minimum_ht, maximum_ht, 2, first, last);
 
     // go through the height matrix
     // look for local extremes
     // start at 1 and end at order - 1 to stay off boundaries
     // update where possible
 
-    for(int phase=0; phase<2; ++phase) {
-        for(int row=1; row<n_rows-1; ++row) {
-            for(int col=(row%2==phase ? 2 : 1); col<n_cols-1; col+=2) {
-                // invariant: (row + col) % 2 == phase
-                /* if((row+col)%2 != phase)
-                    std::cout<<"bad row and col"<<row<<", "<<col<<std::endl; */
-                coin_flip = random_pm1(rn_gen); // uniform random +1 or -1
-                if(is_extreme(minimum_ht, row, col))
-                    minimum_ht[row][col] = minimum_ht[row-1][col] + coin_flip;
-                if(is_extreme(maximum_ht, row, col))
-                    maximum_ht[row][col] = maximum_ht[row-1][col] + coin_flip;
+    // within one phase the sites with (row + col) % 2 == phase don't
+    // depend on each other, so the rows can be split across threads
+    #pragma omp parallel reduction(+:delta, min_flips, max_flips)
+    {
+        uint32_t *bits = new uint32_t[n_words];
+        int row_flips[2] = {0, 0};
+        for(int phase=0; phase<2; ++phase) {
+            // the phase of the sites of this row numbering
+            const int local_phase = phase ^ (first_row & 1);
+            #pragma omp for schedule(static)
+            for(int row=1; row<n_rows-1; ++row) {
+                row_coins(seed, step, first_row + row, n_cols, bits);
+                if(row >= first - 1 - phase && row <= last + 1 + phase)
+                    delta += kernel(minimum_ht, maximum_ht, row, local_phase,
+                                    bits, row_flips);
+                else
+                    coalesced_kernel(minimum_ht, maximum_ht, row, local_phase,
+                                     bits, row_flips);
+                if(Count) {
+                    min_flips += row_flips[0];
+                    max_flips += row_flips[1];
+                    row_flips[0] = row_flips[1] = 0;
+                }
             }
         }
+        delete [] bits;
+    }
+    if(Count) {
+        flips->min += min_flips;
+        flips->max += max_flips;
     }
+    return delta;
 }
 
-// Runs the main loop for monotone coupling from the past dynamics
-void run_cftp(int **minimum_ht, int **maximum_ht, const int n_rows,
-              const int n_cols, RNG &rn_gen, const int seeds[256],
-              const int initial, const bool report, const bool timing) {
+template<typename T>
+static long long evolve_width(HeightField &minimum_ht, HeightField &maximum_ht,
+                              const int seed, const long long step,
+                              FlipCounts *flips, const int first_row) {
+    if(flips != NULL)
+        return evolve_rows<T, true>(minimum_ht, maximum_ht, seed, step, flips,
+                                    first_row);
+    return evolve_rows<T, false>(minimum_ht, maximum_ht, seed, step, flips,
+                                 first_row);
+}
+
+// Evolves the min and max height functions according to the
+// monotone coupling from the past dynamics
+long long evolve_ht(HeightField &minimum_ht, HeightField &maximum_ht,
+                    const int seed, const long long step, FlipCounts *flips,
+                    const int first_row) {
+    if(minimum_ht.width() == 1)
+        return evolve_width<int8_t>(minimum_ht, maximum_ht, seed, step, flips,
+                                    first_row);
+    if(minimum_ht.width() == 2)
+        return evolve_width<int16_t>(minimum_ht, maximum_ht, seed, step, flips,
+                                     first_row);
+    return evolve_width<int>(minimum_ht, maximum_ht, seed, step, flips,
+                             first_row);
+}
+
+typedef int (*pair_kernel)(HeightPair &, const int, const int,
+                           const uint32_t *);
+
+// Sweeps both phases over the rows of a pair, entries of type T (there
+// is no skipping coalesced rows: their min and max come in the same pass)
+template<typename T>
+static long long evolve_pair_rows(HeightPair &pair, const int seed,
+                                  const long long step) {
+    const int n_rows = pair.n_rows(), n_cols = pair.n_cols();
+    const int n_words = coin_words(n_cols);
+    pair_kernel kernel = update_pair_row_scalar<T>;
+#ifdef RASM_HAVE_AVX2
+    if(use_avx2())
+        kernel = update_pair_row_avx2<T>;
+#endif
+    long long delta = 0;
+    #pragma omp parallel reduction(+:delta)
+    {
+        uint32_t *bits = new uint32_t[n_words];
+        for(int phase=0; phase<2; ++phase) {
+            #pragma omp for schedule(static)
+            for(int row=1; row<n_rows-1; ++row) {
+                row_coins(seed, step, row, n_cols, bits);
+                delta += kernel(pair, row, phase, bits);
+            }
+        }
+        delete [] bits;
+    }
+    return delta;
+}
+
+// Evolves the min and max of a pair, both in one pass
+long long evolve_ht(HeightPair &pair, const int seed, const long long step) {
+    if(pair.width() == 1)
+        return evolve_pair_rows<int8_t>(pair, seed, step);
+    if(pair.width() == 2)
+        return evolve_pair_rows<int16_t>(pair, seed, step);
+    return evolve_pair_rows<int>(pair, seed, step);
+}
+
+// Sweeps steps step, step - 1, ..., step - sweeps + 1 as a wavefront
+// going down the rows, entries of type T. Half-step h (phase h % 2 of
+// sweep h / 2) of a row needs the rows next to it at half-step h - 1 and
+// not yet at h + 1 (half-step h itself only writes the sites it doesn't
+// read), so wave w updating row w - h at every h, h going up, does them
+// in an order that works: only the 2 * sweeps + 2 rows around the front
+// are touched at a time, and they stay in cache.
+template<typename T>
+static long long evolve_tiled_rows(HeightField &minimum_ht,
+                                   HeightField &maximum_ht, const int seed,
+                                   const long long step, const int sweeps) {
+    const int n_rows = minimum_ht.n_rows(), n_cols = minimum_ht.n_cols();
+    const int n_words = coin_words(n_cols), half_steps = 2 * sweeps;
+    const row_kernel kernel = select_kernel<T, true, false>();
+    const row_kernel coalesced_kernel = select_kernel<T, false, false>();
+    // the difference spreads by at most a row per half-step
+    int first, last;
+    differing_rows<T>(minimum_ht, maximum_ht, half_steps + 1, first, last);
+
+    // the coins of a row are drawn by its first phase and kept for its
+    // second, a wave later (by which time the first phase has only gone
+    // one row on, so two rows of coins per sweep do)
+    std::vector<uint32_t> coins((std::size_t) 2 * sweeps * n_words);
+    long long delta = 0;
+    int unused[2];
+    for(int wave=1; wave<n_rows-2+half_steps; ++wave)
+        for(int h=0; h<half_steps && wave-h>=1; ++h) {
+            const int row = wave - h;
+            if(row > n_rows - 2)
+                continue;
+            uint32_t *bits = &coins[(std::size_t) (2 * (h / 2) + row % 2) * n_words];
+            if(h % 2 == 0)
+                row_coins(seed, step - h / 2, row, n_cols, bits);
+            if(row >= first - 1 - h && row <= last + 1 + h)
+                delta += kernel(minimum_ht, maximum_ht, row, h % 2, bits, unused);
+            else
+                coalesced_kernel(minimum_ht, maximum_ht, row, h % 2, bits, unused);
+        }
+    return delta;
+}
+
+// The number of sweeps evolve_ht_sweeps is given at a time, 0 for auto
+static int &tile_setting() {
+    static int sweeps = 0;
+    return sweeps;
+}
+
+void set_evolve_tile(const int sweeps) {
+    tile_setting() = std::max(sweeps, 0);
+}
+
+// Auto: one sweep at a time while both height functions fit in the L2
+// cache (or several threads share the sweeps), else 8
+int evolve_tile(const HeightField &matrix_ht) {
+    if(tile_setting() > 0)
+        return tile_setting();
+#ifdef _OPENMP
+    if(omp_get_max_threads() > 1)
+        return 1;
+#endif
+    long cache = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if(cache <= 0)
+        cache = 1 << 20;
+    const std::size_t bytes = 2 * (std::size_t) matrix_ht.width()
+                              * matrix_ht.n_rows() * matrix_ht.stride();
+    return bytes <= (std::size_t) cache ? 1 : 8;
+}
+
+// Whether run_cftp sweeps its min and max as a HeightPair
+static bool &use_pair() {
+    static bool pair = false;
+    return pair;
+}
+
+bool set_evolve_layout(const char *name) {
+    if(!std::strcmp(name, "separate"))
+        use_pair() = false;
+    else if(!std::strcmp(name, "pair"))
+        use_pair() = true;
+    else
+        return false;
+    return true;
+}
+
+const char *evolve_layout_name() {
+    return use_pair() ? "pair" : "separate";
+}
+
+// Several sweeps with the same seed, as a wavefront when run on one
+// thread; with OpenMP the rows of a phase are split across threads instead
+long long evolve_ht_sweeps(HeightField &minimum_ht, HeightField &maximum_ht,
+                           const int seed, const long long step,
+                           const int sweeps) {
+    bool wavefront = sweeps > 1;
+#ifdef _OPENMP
+    wavefront = wavefront && omp_get_max_threads() == 1;
+#endif
+    if(!wavefront) {
+        long long delta = 0;
+        for(int k=0; k<sweeps; ++k)
+            delta += evolve_ht(minimum_ht, maximum_ht, seed, step - k);
+        return delta;
+    }
+    if(minimum_ht.width() == 1)
+        return evolve_tiled_rows<int8_t>(minimum_ht, maximum_ht, seed, step, sweeps);
+    if(minimum_ht.width() == 2)
+        return evolve_tiled_rows<int16_t>(minimum_ht, maximum_ht, seed, step, sweeps);
+    return evolve_tiled_rows<int>(minimum_ht, maximum_ht, seed, step, sweeps);
+}
+
+// The checkpoint file is a header followed by two slots that are written
+// in turn, so that the last complete checkpoint survives a crash while
+// the other slot is being written. A slot is its header, then the min
+// and the max height functions as laid out in memory.
+namespace {
+const char checkpoint_magic[8] = {'R', 'A', 'S', 'M', 'C', 'K', 'P', 'T'};
+const uint32_t checkpoint_version = 1;
+
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t n_rows, n_cols, width, stride;
+    uint32_t zero;
+    uint64_t slot_bytes;
+};
+
+struct SlotHeader {
+    uint64_t sequence; // 0 while the slot is written, then > 0
+    uint64_t checksum; // of the slot after this header
+    int32_t random_seed, time_steps, step, zero;
+    int64_t volume, initial_volume;
+    int32_t seeds[256];
+};
+
+// slots start on a 64 byte boundary, as do the height functions in them
+const std::size_t header_bytes = 64;
+const std::size_t slot_header_bytes = (sizeof(SlotHeader) + 63) & ~(std::size_t) 63;
 
-    int step;
-    std::time_t start, end; // for elapsed time
+// FNV-1a, enough to tell a torn slot from a complete one
+uint64_t checksum(const unsigned char *bytes, const std::size_t n) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for(std::size_t i=0; i<n; ++i)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+    return hash;
+}
+
+std::size_t field_bytes(const HeightField &ht) {
+    return (std::size_t) ht.width() * ht.n_rows() * ht.stride();
+}
+}
+
+// Maps the file, made the right size for the height functions; a
+// checkpoint of the same shape already in it is kept, and saves go on
+// numbering after it
+Checkpoint::Checkpoint(const char *path, const HeightField &shape,
+                       const int random_seed, const double every)
+    : map_(NULL), bytes_(0), slot_bytes_(0), sequence_(0),
+      random_seed_(random_seed), every_(every),
+      last_save_(std::chrono::steady_clock::now()) {
+    slot_bytes_ = slot_header_bytes + 2 * field_bytes(shape);
+    bytes_ = header_bytes + 2 * slot_bytes_;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+        throw std::runtime_error(std::string("can't open checkpoint ") + path);
+    if(ftruncate(fd, bytes_) != 0) {
+        close(fd);
+        throw std::runtime_error(std::string("can't size checkpoint ") + path);
+    }
+    void *map = mmap(NULL, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        throw std::runtime_error(std::string("can't map checkpoint ") + path);
+    map_ = (unsigned char *) map;
+
+    CheckpointHeader header;
+    std::memcpy(&header, map_, sizeof(header));
+    if(std::memcmp(header.magic, checkpoint_magic, 8) ||
+       header.version != checkpoint_version || header.n_rows != shape.n_rows() ||
+       header.n_cols != shape.n_cols() || header.width != shape.width() ||
+       header.stride != shape.stride() || header.slot_bytes != slot_bytes_) {
+        // a new checkpoint: no valid slot yet
+        std::memset(map_, 0, bytes_);
+        std::memcpy(header.magic, checkpoint_magic, 8);
+        header.version = checkpoint_version;
+        header.n_rows = shape.n_rows();
+        header.n_cols = shape.n_cols();
+        header.width = shape.width();
+        header.stride = shape.stride();
+        header.zero = 0;
+        header.slot_bytes = slot_bytes_;
+        std::memcpy(map_, &header, sizeof(header));
+    }
+    for(int slot=0; slot<2; ++slot) {
+        SlotHeader sh;
+        std::memcpy(&sh, map_ + header_bytes + slot * slot_bytes_, sizeof(sh));
+        sequence_ = std::max(sequence_, sh.sequence);
+    }
+}
+
+Checkpoint::~Checkpoint() {
+    if(map_ != NULL) {
+        msync(map_, bytes_, MS_SYNC);
+        munmap(map_, bytes_);
+    }
+}
+
+bool Checkpoint::due() const {
+    std::chrono::duration<double> since = std::chrono::steady_clock::now()
+                                          - last_save_;
+    return since.count() >= every_;
+}
+
+// Copies the state into the older slot; the copy goes to the page cache
+// and msync only schedules the write to disk, so this doesn't wait on it
+void Checkpoint::save(const int seeds[256], const int time_steps,
+                      const int step, const long long volume,
+                      const long long initial_volume,
+                      const HeightField &minimum_ht,
+                      const HeightField &maximum_ht) {
+    ++sequence_;
+    unsigned char *slot = map_ + header_bytes + (sequence_ % 2) * slot_bytes_;
+    SlotHeader sh;
+    std::memset(&sh, 0, sizeof(sh));
+    std::memcpy(slot, &sh, sizeof(sh)); // sequence 0: being written
+
+    sh.random_seed = random_seed_;
+    sh.time_steps = time_steps;
+    sh.step = step;
+    sh.volume = volume;
+    sh.initial_volume = initial_volume;
+    std::memcpy(sh.seeds, seeds, sizeof(sh.seeds));
+    const std::size_t field = field_bytes(minimum_ht);
+    unsigned char *body = slot + slot_header_bytes;
+    std::memcpy(body, minimum_ht.data(), field);
+    std::memcpy(body + field, maximum_ht.data(), field);
+    std::memcpy(slot + 2 * sizeof(uint64_t), &sh.random_seed,
+                sizeof(sh) - 2 * sizeof(uint64_t));
+
+    // the checksum covers the slot after the sequence and the checksum
+    sh.checksum = checksum(slot + 2 * sizeof(uint64_t),
+                           slot_bytes_ - 2 * sizeof(uint64_t));
+    std::memcpy(slot + sizeof(uint64_t), &sh.checksum, sizeof(uint64_t));
+    std::memcpy(slot, &sequence_, sizeof(uint64_t));
+    msync(map_, bytes_, MS_ASYNC);
+    last_save_ = std::chrono::steady_clock::now();
+}
+
+// Reads the newest complete slot of a checkpoint file
+bool load_checkpoint(const char *path, int &random_seed, int seeds[256],
+                     CftpProgress &progress, HeightField &minimum_ht,
+                     HeightField &maximum_ht) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> file((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    CheckpointHeader header;
+    if(file.size() < header_bytes)
+        return false;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if(std::memcmp(header.magic, checkpoint_magic, 8) ||
+       header.version != checkpoint_version ||
+       file.size() < header_bytes + 2 * header.slot_bytes)
+        return false;
+
+    const unsigned char *best = NULL;
+    uint64_t best_sequence = 0;
+    for(int slot=0; slot<2; ++slot) {
+        const unsigned char *start = (const unsigned char *) file.data()
+                                     + header_bytes + slot * header.slot_bytes;
+        SlotHeader sh;
+        std::memcpy(&sh, start, sizeof(sh));
+        if(sh.sequence > best_sequence &&
+           sh.checksum == checksum(start + 2 * sizeof(uint64_t),
+                                   header.slot_bytes - 2 * sizeof(uint64_t))) {
+            best = start;
+            best_sequence = sh.sequence;
+        }
+    }
+    if(best == NULL)
+        return false;
+
+    SlotHeader sh;
+    std::memcpy(&sh, best, sizeof(sh));
+    random_seed = sh.random_seed;
+    std::memcpy(seeds, sh.seeds, sizeof(sh.seeds));
+    progress.time_steps = sh.time_steps;
+    progress.step = sh.step;
+    progress.volume = sh.volume;
+    progress.initial_volume = sh.initial_volume;
+    minimum_ht.resize(header.n_rows, header.n_cols, header.width);
+    maximum_ht.resize(header.n_rows, header.n_cols, header.width);
+    if(minimum_ht.stride() != header.stride)
+        return false;
+    const std::size_t field = field_bytes(minimum_ht);
+    std::memcpy(minimum_ht.data(), best + slot_header_bytes, field);
+    std::memcpy(maximum_ht.data(), best + slot_header_bytes + field, field);
+    return true;
+}
+
+Rocftp::Rocftp(const int order, const int random_seed, const int block,
+               const int width, const int report)
+    : block_index_(0), random_seed_(random_seed), block_(block),
+      report_(report), started_(false) {
+    if(order < 1)
+        throw std::invalid_argument("invalid order " + std::to_string(order));
+    if(block < 1)
+        throw std::invalid_argument("invalid block " + std::to_string(block));
+    const int bytes = std::max(width, ht_width(order + 1));
+    minimum_ht_.resize(order + 1, order + 1, bytes);
+    maximum_ht_.resize(order + 1, order + 1, bytes);
+    initialize_ht(minimum_ht_, maximum_ht_);
+    initial_volume_ = volume_diff(minimum_ht_, maximum_ht_);
+}
+
+// A Philox block keyed by the random seed, counting the blocks
+int Rocftp::block_seed(const long long index) const {
+    const uint32_t key[2] = {(uint32_t) random_seed_, 0x20CF7B10u};
+    uint32_t ctr[4] = {(uint32_t) index, (uint32_t) (index >> 32), 0, 0};
+    philox4x32(ctr, key);
+    return (int) ctr[0];
+}
+
+// Runs blocks until one coalesces with the state being followed; a block
+// that doesn't coalesce moves the state on with the same coins, one that
+// does gives a sample (the state before it) and a new state (its output)
+long long Rocftp::next(HeightField &sample) {
+    long long sweeps = 0;
+    while(true) {
+        const int seed = block_seed(block_index_++);
+        initialize_ht(minimum_ht_, maximum_ht_);
+        long long volume = initial_volume_;
+        const int tile = evolve_tile(maximum_ht_);
+        for(int step=block_; step>0; step-=std::min(tile, step)) {
+            const int batch = std::min(tile, step);
+            // once coalesced, the max alone is the output of the block
+            if(volume) {
+                volume += evolve_ht_sweeps(minimum_ht_, maximum_ht_, seed, step,
+                                           batch);
+                sweeps += 2 * batch;
+            }
+            else {
+                evolve_ht_sweeps(maximum_ht_, maximum_ht_, seed, step, batch);
+                sweeps += batch;
+            }
+        }
+        if(report_)
+            std::cerr << "Block " << block_index_ - 1
+                      << (volume ? " didn't coalesce, volume " : " coalesced")
+                      << (volume ? std::to_string(volume) : std::string())
+                      << std::endl;
+
+        if(!volume && started_) {
+            sample = state_;
+            state_ = maximum_ht_;
+            return sweeps;
+        }
+        if(!volume) {
+            started_ = true;
+            state_ = maximum_ht_;
+        }
+        else if(started_) {
+            const int tile = evolve_tile(state_);
+            for(int step=block_; step>0; step-=std::min(tile, step))
+                evolve_ht_sweeps(state_, state_, seed, step, std::min(tile, step));
+            sweeps += block_;
+        }
+    }
+}
+
+// The min and max of a run of coupling from the past at every spacing-th
+// step, and at the end. The last time_steps / 2 steps of the next run see
+// the same coins, so once one of its chains is equal to the same chain of
+// this run at the same step, the rest of that chain is already known.
+namespace {
+// memory for the snapshots of one run, and their most
+const std::size_t snapshot_budget = 64 << 20;
+const int max_snapshots = 64;
+// the sites of the smallest height functions that are worth taking
+// snapshots of: a run of smaller ones is over before copying them pays off
+const long long min_snapshot_sites = 1 << 14;
+
+struct RunSnapshots {
+    int time_steps; // the run, 0 for none
+    int spacing;
+    std::map<int, std::pair<HeightField, HeightField> > at; // by step
+    HeightField final_min, final_max;
+
+    RunSnapshots() : time_steps(0), spacing(1) {}
+
+    // the spacing for a run, a power of two that doubles with time_steps
+    // (so every snapshot of the next run is at a step this run has one)
+    // and keeps the snapshots within budget; 0 if even one is too many or
+    // the height functions are too small for them
+    static int spacing_for(const int time_steps, const HeightField &ht) {
+        if((long long) ht.n_rows() * ht.n_cols() < min_snapshot_sites)
+            return 0;
+        std::size_t bytes = 2 * (std::size_t) ht.width() * ht.n_rows() * ht.stride();
+        int count = max_snapshots;
+        while(count > 0 && count * bytes > snapshot_budget)
+            count /= 2;
+        if(count == 0)
+            return 0;
+        return std::max(1, time_steps / count);
+    }
+
+    const HeightField *min_at(const int step) const {
+        auto it = at.find(step);
+        return it == at.end() ? NULL : &it->second.first;
+    }
+    const HeightField *max_at(const int step) const {
+        auto it = at.find(step);
+        return it == at.end() ? NULL : &it->second.second;
+    }
+};
+
+bool same_heights(const HeightField &a, const HeightField &b) {
+    return !std::memcmp(a.data(), b.data(), (std::size_t) a.width()
+                        * a.n_rows() * a.stride());
+}
+}
+
+// The number of inner sites (those evolve_ht updates) where the min and
+// max agree
+template<typename T>
+static long long coalesced_sites_rows(const HeightField &minimum_ht,
+                                      const HeightField &maximum_ht) {
+    long long sites = 0;
+    for(int row=1; row<minimum_ht.n_rows()-1; ++row) {
+        const T *min_row = minimum_ht.row<T>(row);
+        const T *max_row = maximum_ht.row<T>(row);
+        for(int col=1; col<minimum_ht.n_cols()-1; ++col)
+            sites += min_row[col] == max_row[col];
+    }
+    return sites;
+}
+
+static long long coalesced_sites(const HeightField &minimum_ht,
+                                 const HeightField &maximum_ht) {
+    if(minimum_ht.width() == 1)
+        return coalesced_sites_rows<int8_t>(minimum_ht, maximum_ht);
+    if(minimum_ht.width() == 2)
+        return coalesced_sites_rows<int16_t>(minimum_ht, maximum_ht);
+    return coalesced_sites_rows<int>(minimum_ht, maximum_ht);
+}
+
+void Telemetry::Tally::reset() {
+    sweeps = min_flips = max_flips = 0;
+    wall = std::chrono::steady_clock::now();
+    cpu = std::clock();
+}
+
+Telemetry::Telemetry(const int fd, const double every)
+    : fd_(fd), every_(every) {
+    epoch_.reset();
+    progress_.reset();
+    total_.reset();
+}
+
+void Telemetry::sweep(const int sweeps, const long long min_flips,
+                      const long long max_flips) {
+    Tally *tallies[3] = {&epoch_, &progress_, &total_};
+    for(Tally *tally : tallies) {
+        tally->sweeps += sweeps;
+        tally->min_flips += min_flips;
+        tally->max_flips += max_flips;
+    }
+}
+
+bool Telemetry::due() const {
+    std::chrono::duration<double> since = std::chrono::steady_clock::now()
+                                          - progress_.wall;
+    return since.count() >= every_;
+}
+
+// Writes a whole line (a write to a pipe of up to PIPE_BUF bytes is done
+// in one go, so the lines of several runs sharing one don't interleave)
+static void write_fully(const int fd, const char *line, const int n) {
+    for(int written=0; written<n; ) {
+        const ssize_t k = ::write(fd, line + written, n - written);
+        if(k <= 0)
+            return;
+        written += k;
+    }
+}
+
+void Telemetry::write_line(const char *event, const Tally &tally,
+                           const int time_steps, const int epoch,
+                           const int step, const long long volume,
+                           const HeightField *minimum_ht,
+                           const HeightField *maximum_ht) {
+    const std::chrono::duration<double> wall = std::chrono::steady_clock::now()
+                                               - tally.wall;
+    const double cpu = (double) (std::clock() - tally.cpu) / CLOCKS_PER_SEC;
+    char line[512];
+    int n = std::snprintf(line, sizeof(line),
+        "{\"event\":\"%s\",\"time_steps\":%d,\"epoch\":%d,\"step\":%d,"
+        "\"sweeps\":%lld,\"flips_min\":%lld,\"flips_max\":%lld,"
+        "\"wall\":%.6f,\"cpu\":%.6f,\"sweeps_per_sec\":%.6g,",
+        event, time_steps, epoch, step, tally.sweeps, tally.min_flips,
+        tally.max_flips, wall.count(), cpu,
+        wall.count() > 0 ? tally.sweeps / wall.count() : 0.0);
+    if(minimum_ht != NULL) {
+        const double inner = (double) (minimum_ht->n_rows() - 2)
+                                    * (minimum_ht->n_cols() - 2);
+        n += std::snprintf(line + n, sizeof(line) - n,
+            "\"volume\":%lld,\"coalesced_fraction\":%.6f,\"total_sweeps\":%lld}\n",
+            volume, inner > 0 ? coalesced_sites(*minimum_ht, *maximum_ht) / inner : 1.0,
+            total_.sweeps);
+    }
+    else
+        n += std::snprintf(line + n, sizeof(line) - n,
+            "\"volume\":null,\"coalesced_fraction\":null,\"total_sweeps\":%lld}\n",
+            total_.sweeps);
+    write_fully(fd_, line, n);
+}
 
-    if(timing)
-        start = std::clock(); // start the clock
+void Telemetry::progress(const int time_steps, const int step,
+                         const long long volume, const HeightField *minimum_ht,
+                         const HeightField *maximum_ht) {
+    write_line("progress", progress_, time_steps, log2_int(std::max(step, 1)),
+               step, volume, minimum_ht, maximum_ht);
+    progress_.reset();
+}
+
+void Telemetry::epoch(const int time_steps, const int epoch, const int step,
+                      const long long volume, const HeightField *minimum_ht,
+                      const HeightField *maximum_ht) {
+    write_line("epoch", epoch_, time_steps, epoch, step, volume, minimum_ht,
+               maximum_ht);
+    epoch_.reset();
+}
+
+void Telemetry::run(const int time_steps, const long long volume,
+                    const bool coalesced) {
+    char line[256];
+    const int n = std::snprintf(line, sizeof(line),
+        "{\"event\":\"run\",\"time_steps\":%d,\"volume\":%lld,"
+        "\"coalesced\":%s,\"total_sweeps\":%lld}\n",
+        time_steps, volume, coalesced ? "true" : "false", total_.sweeps);
+    write_fully(fd_, line, n);
+}
+
+// The number of -1 entries of the ASM of rows 1 to n_rows - 1
+template<typename T>
+static double minus_ones_rows(const HeightField &matrix_ht) {
+    long long count = 0;
+    for(int row=1; row<matrix_ht.n_rows(); ++row) {
+        const T *up = matrix_ht.row<T>(row-1), *cur = matrix_ht.row<T>(row);
+        for(int col=1; col<matrix_ht.n_cols(); ++col)
+            count += up[col] + cur[col-1] - cur[col] - up[col-1] == -2;
+    }
+    return count;
+}
+
+Observable minus_ones_observable() {
+    return {"minus_ones", 1, [](const HeightField &matrix_ht, double *values) {
+        if(matrix_ht.width() == 1)
+            values[0] = minus_ones_rows<int8_t>(matrix_ht);
+        else if(matrix_ht.width() == 2)
+            values[0] = minus_ones_rows<int16_t>(matrix_ht);
+        else
+            values[0] = minus_ones_rows<int>(matrix_ht);
+    }};
+}
+
+Observable csum_diagonal_observable(const HeightField &matrix_ht) {
+    const int size = std::min(matrix_ht.n_rows(), matrix_ht.n_cols());
+    return {"csum_diagonal", size, [size](const HeightField &ht, double *values) {
+        for(int k=0; k<size; ++k)
+            values[k] = (2 * k + 2 - ht.get(k, k)) / 2;
+    }};
+}
+
+Observable asm_entries_observable(const HeightField &matrix_ht) {
+    const int size = (matrix_ht.n_rows() - 1) * (matrix_ht.n_cols() - 1);
+    return {"asm_entries", size, [](const HeightField &ht, double *values) {
+        for(int row=1; row<ht.n_rows(); ++row)
+            for(int col=1; col<ht.n_cols(); ++col)
+                *values++ = (ht.get(row-1, col) + ht.get(row, col-1)
+                             - ht.get(row, col) - ht.get(row-1, col-1)) / 2;
+    }};
+}
+
+Observable row_minus_ones_observable(const HeightField &matrix_ht) {
+    return {"row_minus_ones", matrix_ht.n_rows() - 1,
+            [](const HeightField &ht, double *values) {
+        for(int row=1; row<ht.n_rows(); ++row) {
+            values[row-1] = 0;
+            for(int col=1; col<ht.n_cols(); ++col)
+                values[row-1] += ht.get(row-1, col) + ht.get(row, col-1)
+                                 - ht.get(row, col) - ht.get(row-1, col-1) == -2;
+        }
+    }};
+}
+
+Observable height_histogram_observable(const HeightField &matrix_ht) {
+    // the boundary |row - col| + 1 of initialize_ht is the largest
+    const int size = std::max(matrix_ht.n_rows(), matrix_ht.n_cols()) + 1;
+    return {"height_histogram", size, [size](const HeightField &ht,
+                                             double *values) {
+        std::fill(values, values + size, 0.0);
+        for(int row=0; row<ht.n_rows(); ++row)
+            for(int col=0; col<ht.n_cols(); ++col) {
+                const int height = ht.get(row, col);
+                if(height >= 0 && height < size)
+                    ++values[height];
+            }
+    }};
+}
+
+Accumulator::Accumulator(const std::vector<Observable> &observables)
+    : observables_(observables), count_(0) {
+    int size = 0;
+    for(const Observable &observable : observables_) {
+        offsets_.push_back(size);
+        size += observable.size;
+    }
+    sums_.assign(size, 0.0);
+    squares_.assign(size, 0.0);
+    values_.resize(size);
+}
+
+void Accumulator::add(const HeightField &sample) {
+    for(std::size_t i=0; i<observables_.size(); ++i)
+        observables_[i].compute(sample, &values_[offsets_[i]]);
+    for(std::size_t k=0; k<values_.size(); ++k) {
+        sums_[k] += values_[k];
+        squares_[k] += values_[k] * values_[k];
+    }
+    ++count_;
+}
+
+void Accumulator::merge(const Accumulator &other) {
+    if(other.sums_.size() != sums_.size())
+        throw std::invalid_argument("Merging accumulators of other observables");
+    for(std::size_t k=0; k<sums_.size(); ++k) {
+        sums_[k] += other.sums_[k];
+        squares_[k] += other.squares_[k];
+    }
+    count_ += other.count_;
+}
+
+Trajectory::Trajectory(const int sweeps,
+                       const std::vector<Observable> &observables)
+    : sweeps_(sweeps), times_(0), stride_(0), observables_(observables) {
+    if(sweeps < 1)
+        throw std::invalid_argument("A trajectory needs at least one sweep");
+    for(const Observable &observable : observables_) {
+        offsets_.push_back(stride_);
+        stride_ += observable.size;
+    }
+    values_.resize((std::size_t) sweeps_ * stride_);
+    volumes_.resize(sweeps_);
+}
+
+void Trajectory::start(const int time_steps) {
+    times_ = std::min(sweeps_, time_steps);
+    std::fill(volumes_.begin(), volumes_.end(), -1);
+}
+
+void Trajectory::record(const int t, const long long volume,
+                        const HeightField &maximum_ht) {
+    volumes_[t] = volume;
+    for(std::size_t i=0; i<observables_.size(); ++i)
+        observables_[i].compute(maximum_ht,
+                                &values_[(std::size_t) t * stride_ + offsets_[i]]);
+}
+
+// Runs the main loop for monotone coupling from the past dynamics
+int run_cftp(HeightField &minimum_ht, HeightField &maximum_ht,
+             const int seeds[256], const int initial, const int report,
+             const bool timing, Checkpoint *checkpoint,
+             const CftpProgress *resume, Telemetry *telemetry,
+             PhaseTimer *timer, Trajectory *trajectory) {
+
+    int step = 0;
+    // the phases are timed in any case, the clocks are only read when
+    // the phase changes (which is rare, as a sweep is always sampling)
+    PhaseTimer own_timer;
+    PhaseTimer &phases = timer != NULL ? *timer : own_timer;
+    const PhaseTimer::Phase outer = phases.phase();
+    const double start_wall = phases.wall(), start_cpu = phases.cpu();
+    phases.enter(PhaseTimer::INITIALIZATION);
 
     // we now run the coupling from the past main loop
     // starting from time = -initial all the way to time 0
     // and restarting with doubling time if it hasn't converged
+    // the volume of max - min is only scanned for once, every restart
+    // starts from the same min and max and evolve_ht returns the changes
+    long long initial_volume, volume;
     int time_steps = initial;
-    while(volume_diff(minimum_ht, maximum_ht, n_rows, n_cols)) {
-        step = time_steps;
+    if(resume != NULL) {
+        // carry on with the run the checkpoint was taken in
+        initial_volume = resume->initial_volume;
+        volume = resume->volume;
+        time_steps = resume->time_steps;
+        step = resume->step;
+    }
+    else
+        initial_volume = volume = volume_diff(minimum_ht, maximum_ht);
+    bool resuming = resume != NULL;
+    const int tile = evolve_tile(minimum_ht);
+    // the min and max swept as a pair while both are evolved, unpacked
+    // whenever they are looked at (a trajectory and the telemetry look
+    // at every sweep, they are kept separate for them)
+    const bool pair_layout = use_pair() && telemetry == NULL && trajectory == NULL;
+    HeightPair pair;
+    bool packed = false; // the pair is ahead of minimum_ht and maximum_ht
+    int steps_run = 0; // the number of steps of the last run
+    long long sweeps = 0; // of a single height function, in all runs
+    // the previous run and this one, to pick up where this one meets it
+    RunSnapshots previous, current;
+    while(volume || resuming) {
+        if(!resuming) {
+            step = time_steps;
 
-        /* reset min and max heights */
-        initialize_ht(minimum_ht, maximum_ht, n_rows, n_cols);
+            /* reset min and max heights, keeping their boundary */
+            phases.enter(PhaseTimer::INITIALIZATION);
+            initialize_ht_boundary(minimum_ht, maximum_ht);
+            volume = initial_volume;
+        }
+        else
+            previous = RunSnapshots(); // it is lost with the restart
+        resuming = false;
+        current = RunSnapshots();
+        current.time_steps = time_steps;
+        // none in the first run, which is often the only one
+        current.spacing = steps_run > 0
+                          ? RunSnapshots::spacing_for(time_steps, minimum_ht) : 0;
+        const bool have_previous = previous.time_steps > 0 && current.spacing
+                                   && 2 * previous.time_steps == time_steps;
+        // the min (max) chain has met that of the previous run, and is
+        // no longer evolved: it is what the previous run had
+        bool min_known = false, max_known = false;
+        // a trajectory needs both chains over its sweeps: from the first
+        // snapshot at or after them, the known chains are evolved again
+        int watch = 0;
+        if(trajectory != NULL) {
+            trajectory->start(time_steps);
+            if(current.spacing)
+                watch = (trajectory->sweeps() + current.spacing - 1)
+                        / current.spacing * current.spacing;
+        }
 
         int power_of_two = -2;
+        int seed = 0;
 
         // the main coupling from the past loop, runs for a power_of_two steps
         while(step > 0) {
             if(log2_int(step) != power_of_two) {
+                if(telemetry != NULL && power_of_two >= 0) {
+                    phases.enter(PhaseTimer::OUTPUT);
+                    telemetry->epoch(time_steps, power_of_two, step, volume,
+                                     min_known || max_known ? NULL : &minimum_ht,
+                                     &maximum_ht);
+                }
+                phases.enter(PhaseTimer::SAMPLING);
                 power_of_two = log2_int(step);
-                // declare and initialize random number generator
-                // with correct seeds so we use same randomness throughout
-                rn_gen = RNG(seeds[power_of_two]);
-                offset = 32; // needed as we generate random bits
-                             // from random 32-bit ints
+                // switch to the seed of this epoch; the coins are a
+                // function of (seed, step, row, col) so a restart sees
+                // exactly the same randomness at each time step
+                seed = seeds[power_of_two];
 
                 if(report)
                     std::cerr << "Using max number of steps " << time_steps
                         << " and difference in volume at time "
-                        << step << " is "
-                        << volume_diff(maximum_ht, minimum_ht, n_rows, n_cols)
-                        << std::endl;
+                        << step << " is " << volume << std::endl;
+            }
+            // several sweeps at a time (see evolve_tile) up to the end of
+            // the epoch and the next snapshot, unless each one is looked at
+            // (the epoch is the steps from 2^(power_of_two - 1) + 1 to
+            // 2^power_of_two, see log2_int)
+            int batch = 1;
+            if(telemetry == NULL && report < 2 && !pair_layout) {
+                batch = std::min(tile, power_of_two > 0
+                                       ? step - (1 << (power_of_two - 1)) : 1);
+                if(current.spacing)
+                    batch = std::min(batch, step - (step - 1) / current.spacing
+                                                   * current.spacing);
+                if(trajectory != NULL)
+                    batch = step > trajectory->sweeps()
+                            ? std::min(batch, step - trajectory->sweeps()) : 1;
+            }
+            // the flips are only counted for the telemetry
+            FlipCounts flips = {0, 0};
+            FlipCounts *count = telemetry != NULL ? &flips : NULL;
+            auto evolve = [&](HeightField &min_ht, HeightField &max_ht) {
+                return batch > 1 ? evolve_ht_sweeps(min_ht, max_ht, seed, step, batch)
+                                 : evolve_ht(min_ht, max_ht, seed, step, count);
+            };
+            if(min_known)
+                evolve(maximum_ht, maximum_ht);
+            else if(max_known)
+                evolve(minimum_ht, minimum_ht);
+            else if(pair_layout) {
+                if(!packed)
+                    pair.pack(minimum_ht, maximum_ht);
+                packed = true;
+                volume += evolve_ht(pair, seed, step);
+                sweeps += batch;
+            }
+            else {
+                volume += evolve(minimum_ht, maximum_ht);
+                sweeps += batch;
+            }
+            sweeps += batch;
+            step -= batch;
+            if(telemetry != NULL) {
+                telemetry->sweep(min_known || max_known ? 1 : 2,
+                                 min_known ? 0 : flips.min,
+                                 max_known ? 0 : flips.max);
+                if(telemetry->due()) {
+                    phases.enter(PhaseTimer::OUTPUT);
+                    telemetry->progress(time_steps, step, volume,
+                                        min_known || max_known ? NULL : &minimum_ht,
+                                        &maximum_ht);
+                    phases.enter(PhaseTimer::SAMPLING);
+                }
+            }
+            if(trajectory != NULL && step < trajectory->sweeps())
+                trajectory->record(step, volume, maximum_ht);
+            if(report > 1 && !min_known && !max_known)
+                std::cerr << "Sweep to time " << step
+                          << " volume " << volume << std::endl;
+            const bool save = checkpoint != NULL && !min_known && !max_known
+                              && checkpoint->due();
+            // the checkpoint, the snapshots and the end of the run look at them
+            if(packed && (save || step == 0
+                          || (current.spacing && step % current.spacing == 0))) {
+                pair.unpack(minimum_ht, maximum_ht);
+                packed = false;
             }
-            evolve_ht(minimum_ht, maximum_ht, n_rows, n_cols, rn_gen);
-            --step;
+            if(save) {
+                phases.enter(PhaseTimer::OUTPUT);
+                checkpoint->save(seeds, time_steps, step, volume,
+                                 initial_volume, minimum_ht, maximum_ht);
+                phases.enter(PhaseTimer::SAMPLING);
+            }
+
+            if(step == 0 || !current.spacing || step % current.spacing)
+                continue;
+            phases.enter(PhaseTimer::CHECKS);
+            if(step == watch && (min_known || max_known)) {
+                // the snapshots of the previous run are at every one of
+                // its spacing up to where a chain met it, watch included
+                if(min_known)
+                    minimum_ht = *previous.min_at(step);
+                if(max_known)
+                    maximum_ht = *previous.max_at(step);
+                min_known = max_known = false;
+                volume = volume_diff(minimum_ht, maximum_ht);
+                if(report)
+                    std::cerr << "Evolving both chains from time " << step
+                              << " for the trajectory" << std::endl;
+            }
+            if(have_previous && step % previous.spacing == 0 && step > watch &&
+               previous.min_at(step) != NULL) {
+                const bool was_known = min_known || max_known;
+                if(!min_known && same_heights(minimum_ht, *previous.min_at(step)))
+                    min_known = true;
+                if(!max_known && same_heights(maximum_ht, *previous.max_at(step)))
+                    max_known = true;
+                if(min_known && max_known) {
+                    // from here on this run is the previous one, which
+                    // didn't coalesce
+                    if(report)
+                        std::cerr << "Both chains meet the previous run at time "
+                                  << step << ", skipping to the next run" << std::endl;
+                    for(; step > 0; step -= current.spacing)
+                        current.at[step] = previous.at[step];
+                    break;
+                }
+                if(report && !was_known && (min_known || max_known))
+                    std::cerr << "The " << (min_known ? "min" : "max")
+                              << " chain meets the previous run at time " << step
+                              << ", only evolving the other one" << std::endl;
+            }
+            current.at[step] = std::make_pair(
+                min_known ? *previous.min_at(step) : minimum_ht,
+                max_known ? *previous.max_at(step) : maximum_ht);
+            // with a chain known the state is only whole at the snapshots
+            if(checkpoint != NULL && (min_known || max_known) && checkpoint->due()) {
+                const std::pair<HeightField, HeightField> &state = current.at[step];
+                phases.enter(PhaseTimer::OUTPUT);
+                checkpoint->save(seeds, time_steps, step,
+                                 volume_diff(state.first, state.second),
+                                 initial_volume, state.first, state.second);
+            }
+            phases.enter(PhaseTimer::SAMPLING);
+        }
+        phases.enter(PhaseTimer::CHECKS);
+        if(min_known)
+            minimum_ht = previous.final_min;
+        if(max_known)
+            maximum_ht = previous.final_max;
+        if(min_known || max_known)
+            volume = volume_diff(minimum_ht, maximum_ht);
+        if(telemetry != NULL) {
+            phases.enter(PhaseTimer::OUTPUT);
+            telemetry->epoch(time_steps, std::max(power_of_two, 0), step,
+                             volume, &minimum_ht, &maximum_ht);
+            telemetry->run(time_steps, volume, volume == 0);
         }
 
         if(report)
             std::cerr << "Volume of difference at time 0 is "
-                      << volume_diff(maximum_ht, minimum_ht, n_rows, n_cols)
-                      << std::endl;
+                      << volume << std::endl;
+
+        steps_run = time_steps;
+        time_steps *= 2;
+        if(volume && current.spacing) {
+            phases.enter(PhaseTimer::CHECKS);
+            current.final_min = minimum_ht;
+            current.final_max = maximum_ht;
+            std::swap(previous, current);
+        }
+    }
+    // the finished state, resuming from it gives the sample right away
+    if(checkpoint != NULL) {
+        phases.enter(PhaseTimer::OUTPUT);
+        checkpoint->save(seeds, steps_run, 0, volume, initial_volume,
+                         minimum_ht, maximum_ht);
+    }
+    phases.enter(outer);
+    if(timing) {
+        std::cerr << "Random ASM of order " << maximum_ht.n_rows()-1
+                  << " x " << maximum_ht.n_cols()-1
+                    << " generated after "
+                    << time_steps / 2 << " steps." << std::endl;
+        std::cerr << "Sweeps of a height function: " << sweeps << "." << std::endl;
+        std::fprintf(stderr, "Elapsed time: %.4f seconds (wall), %.4f seconds of CPU.\n",
+                     phases.wall() - start_wall, phases.cpu() - start_cpu);
+    }
+    return steps_run;
+}
+
+// The strips of run_cftp_strips: worker k owns the rows [lo, hi) with
+// lo = k * n_rows / processes, and keeps the rows [lo - 2, hi + 2) (cut
+// to the height function). A sweep of these updates rows lo - 1 to hi;
+// the outer ones miss a neighbour's first phase, so only the owned rows
+// come out right, and after every sweep each worker gets the two rows on
+// either side of its strip from its neighbours (deep halos: one exchange
+// per sweep, not one per phase).
+// The workers are forked processes. They share an anonymous mapping with
+// the coordinator: the command, a result per worker, the rows they
+// publish (in two buffers, a sweep's halos being read from the previous
+// one's) and the whole height functions for gathering. A command starts
+// on a process-shared semaphore of each worker, and the coordinator waits
+// for every worker to post done, looking for workers that have exited
+// whenever the wait times out: it then kills the others and throws.
+namespace {
+enum StripCommand {STRIP_RESET, STRIP_EVOLVE, STRIP_GATHER, STRIP_QUIT};
+
+struct StripControl {
+    sem_t done;
+    int command, seed;
+    long long step;
+};
+
+// Sums max - min over the rows [from, to)
+long long rows_volume(const HeightField &minimum_ht,
+                      const HeightField &maximum_ht, const int from,
+                      const int to) {
+    long long volume = 0;
+    for(int row=from; row<to; ++row)
+        for(int col=0; col<minimum_ht.n_cols(); ++col)
+            volume += maximum_ht.get(row, col) - minimum_ht.get(row, col);
+    return volume;
+}
+
+class StripWorkers {
+  public:
+    // Forks the workers, each with its strip of these height functions
+    StripWorkers(const HeightField &minimum_ht, const HeightField &maximum_ht,
+                 const int processes);
+    ~StripWorkers() { quit(); }
 
+    // Runs a command on every worker and returns the sum of their results:
+    // the volume of their strips (reset) or its change (evolve)
+    long long command(const StripCommand command, const int seed = 0,
+                      const long long step = 0);
+    // Copies the strips of the workers into the height functions
+    void gather(HeightField &minimum_ht, HeightField &maximum_ht);
+    // Stops the workers and waits for them, their CPU time is then known
+    void quit();
+    // Kills the workers and waits for them (after one of them has died)
+    void kill_all();
+    // The CPU time of the workers, in seconds, once they are done
+    double cpu() const { return cpu_; }
+
+  private:
+    // A worker: its strip, and the commands until it is told to quit
+    void work(const int k, const HeightField &minimum_ht,
+              const HeightField &maximum_ht);
+    // The rows a worker publishes (0, 1: its first two, 2, 3: its last
+    // two) of a chain (0 min, 1 max) in a buffer
+    char *published(const int k, const int buffer, const int chain,
+                    const int r) const {
+        return halos_ + (((std::size_t) (k * 2 + buffer) * 2 + chain) * 4 + r)
+                        * row_bytes_;
+    }
+    int lo(const int k) const {
+        return (int) ((long long) k * n_rows_ / processes_);
+    }
+
+    unsigned char *map_;
+    std::size_t bytes_, row_bytes_;
+    StripControl *control_;
+    sem_t *go_; // one per worker
+    long long *results_;
+    char *halos_, *fields_; // fields_: min then max, for gathering
+    int processes_, n_rows_;
+    std::vector<pid_t> pids_;
+    double cpu_;
+};
+
+StripWorkers::StripWorkers(const HeightField &minimum_ht,
+                           const HeightField &maximum_ht, const int processes)
+    : map_(NULL), processes_(processes), n_rows_(minimum_ht.n_rows()), cpu_(0) {
+    row_bytes_ = (std::size_t) minimum_ht.width() * minimum_ht.stride();
+    // the parts start on 64 byte boundaries
+    const std::size_t control_bytes = (sizeof(StripControl) + processes * sizeof(sem_t)
+                                       + 63) & ~(std::size_t) 63;
+    const std::size_t result_bytes = (processes * sizeof(long long) + 63)
+                                     & ~(std::size_t) 63;
+    const std::size_t halo_bytes = (std::size_t) processes * 16 * row_bytes_;
+    bytes_ = control_bytes + result_bytes + halo_bytes + 2 * field_bytes(minimum_ht);
+    void *map = mmap(NULL, bytes_, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED)
+        throw std::runtime_error("can't map the memory shared with the workers");
+    map_ = (unsigned char *) map;
+    control_ = (StripControl *) map_;
+    go_ = (sem_t *) (map_ + sizeof(StripControl));
+    results_ = (long long *) (map_ + control_bytes);
+    halos_ = (char *) map_ + control_bytes + result_bytes;
+    fields_ = halos_ + halo_bytes;
+
+    sem_init(&control_->done, 1, 0);
+    for(int k=0; k<processes; ++k)
+        sem_init(&go_[k], 1, 0);
+
+    // what is buffered would be written again by every worker on exit
+    std::fflush(NULL);
+    const pid_t coordinator = getpid();
+    for(int k=0; k<processes; ++k) {
+        const pid_t pid = fork();
+        if(pid == 0) {
+            // go down with the coordinator
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if(getppid() != coordinator)
+                _exit(1);
+            // never back into the coordinator's code
+            try {
+                work(k, minimum_ht, maximum_ht);
+            }
+            catch(...) {}
+            _exit(1);
+        }
+        if(pid < 0) {
+            kill_all();
+            throw std::runtime_error("can't start the worker processes");
+        }
+        pids_.push_back(pid);
+    }
+}
+
+void StripWorkers::work(const int k, const HeightField &minimum_ht,
+                        const HeightField &maximum_ht) {
+    const int n_cols = minimum_ht.n_cols(), width = minimum_ht.width();
+    const int lo = this->lo(k), hi = this->lo(k + 1);
+    const int first = std::max(lo - 2, 0), end = std::min(hi + 2, n_rows_);
+    HeightField min_start(end - first, n_cols, width);
+    HeightField max_start(end - first, n_cols, width);
+    for(int row=first; row<end; ++row) {
+        std::memcpy(min_start.data() + (row - first) * row_bytes_,
+                    minimum_ht.data() + row * row_bytes_, row_bytes_);
+        std::memcpy(max_start.data() + (row - first) * row_bytes_,
+                    maximum_ht.data() + row * row_bytes_, row_bytes_);
+    }
+    HeightField strip[2] = {min_start, max_start};
+    // local row r is row first + r of the whole
+    auto local = [&](const int chain, const int row) {
+        return strip[chain].data() + (std::size_t) (row - first) * row_bytes_;
+    };
+    // the local rows swept but not owned, which are off after a sweep
+    std::vector<int> outer;
+    if(lo > 0)
+        outer.push_back(lo - 1 - first);
+    if(hi < n_rows_)
+        outer.push_back(hi - first);
+    auto outer_volume = [&]() {
+        long long volume = 0;
+        for(const int r : outer)
+            volume += rows_volume(strip[0], strip[1], r, r + 1);
+        return volume;
+    };
+    int exchanges = 0; // of halos, the last one in buffer (exchanges - 1) % 2
+    auto publish = [&]() {
+        const int buffer = exchanges++ % 2;
+        const int rows[4] = {lo, lo + 1, hi - 2, hi - 1};
+        for(int chain=0; chain<2; ++chain)
+            for(int r=0; r<4; ++r)
+                std::memcpy(published(k, buffer, chain, r), local(chain, rows[r]),
+                            row_bytes_);
+    };
+
+    for(;;) {
+        while(sem_wait(&go_[k]) != 0) {}
+        const int command = control_->command;
+        if(command == STRIP_QUIT)
+            break;
+        long long result = 0;
+        if(command == STRIP_RESET) {
+            strip[0] = min_start;
+            strip[1] = max_start;
+            result = rows_volume(strip[0], strip[1], lo - first, hi - first);
+            publish();
+        }
+        else if(command == STRIP_EVOLVE) {
+            // the halos: the last two rows above, the first two below
+            const int buffer = (exchanges - 1) % 2;
+            for(int chain=0; chain<2; ++chain) {
+                if(lo > 0) {
+                    std::memcpy(local(chain, lo - 2), published(k - 1, buffer, chain, 2),
+                                row_bytes_);
+                    std::memcpy(local(chain, lo - 1), published(k - 1, buffer, chain, 3),
+                                row_bytes_);
+                }
+                if(hi < n_rows_) {
+                    std::memcpy(local(chain, hi), published(k + 1, buffer, chain, 0),
+                                row_bytes_);
+                    std::memcpy(local(chain, hi + 1), published(k + 1, buffer, chain, 1),
+                                row_bytes_);
+                }
+            }
+            // the change to the owned rows only
+            result = outer_volume();
+            result += evolve_ht(strip[0], strip[1], control_->seed, control_->step,
+                                NULL, first);
+            result -= outer_volume();
+            publish();
+        }
+        else if(command == STRIP_GATHER)
+            for(int chain=0; chain<2; ++chain)
+                std::memcpy(fields_ + chain * (std::size_t) n_rows_ * row_bytes_
+                            + (std::size_t) lo * row_bytes_,
+                            local(chain, lo), (std::size_t) (hi - lo) * row_bytes_);
+        results_[k] = result;
+        sem_post(&control_->done);
+    }
+    _exit(0);
+}
+
+long long StripWorkers::command(const StripCommand command, const int seed,
+                                const long long step) {
+    control_->command = command;
+    control_->seed = seed;
+    control_->step = step;
+    for(int k=0; k<processes_; ++k)
+        sem_post(&go_[k]);
+    for(int posted=0; posted<processes_; ) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += 100000000; // 0.1s
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+        if(sem_timedwait(&control_->done, &deadline) == 0) {
+            ++posted;
+            continue;
+        }
+        if(errno != ETIMEDOUT)
+            continue;
+        // a worker that has exited will never post
+        for(std::size_t k=0; k<pids_.size(); ++k)
+            if(waitpid(pids_[k], NULL, WNOHANG) != 0) {
+                pids_.erase(pids_.begin() + k); // reaped
+                kill_all();
+                throw std::runtime_error("a worker process of run_cftp_strips died");
+            }
+    }
+    long long sum = 0;
+    for(int k=0; k<processes_; ++k)
+        sum += results_[k];
+    return sum;
+}
+
+void StripWorkers::gather(HeightField &minimum_ht, HeightField &maximum_ht) {
+    command(STRIP_GATHER);
+    const std::size_t bytes = (std::size_t) n_rows_ * row_bytes_;
+    std::memcpy(minimum_ht.data(), fields_, bytes);
+    std::memcpy(maximum_ht.data(), fields_ + bytes, bytes);
+}
+
+void StripWorkers::quit() {
+    if(map_ == NULL)
+        return;
+    control_->command = STRIP_QUIT;
+    for(int k=0; k<processes_; ++k)
+        sem_post(&go_[k]);
+    for(const pid_t pid : pids_)
+        waitpid(pid, NULL, 0);
+    pids_.clear();
+    struct rusage usage;
+    if(getrusage(RUSAGE_CHILDREN, &usage) == 0)
+        cpu_ = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+               + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+    kill_all();
+}
+
+void StripWorkers::kill_all() {
+    if(map_ == NULL)
+        return;
+    for(const pid_t pid : pids_) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    pids_.clear();
+    sem_destroy(&control_->done);
+    for(int k=0; k<processes_; ++k)
+        sem_destroy(&go_[k]);
+    munmap(map_, bytes_);
+    map_ = NULL;
+}
+}
+
+int run_cftp_strips(HeightField &minimum_ht, HeightField &maximum_ht,
+                    const int seeds[256], const int initial, const int report,
+                    const bool timing, const int processes, PhaseTimer *timer) {
+    if(processes < 1 || minimum_ht.n_rows() < 2 * processes)
+        throw std::invalid_argument("every worker needs at least two rows");
+    PhaseTimer own_timer;
+    PhaseTimer &phases = timer != NULL ? *timer : own_timer;
+    const PhaseTimer::Phase outer = phases.phase();
+    const double start_wall = phases.wall(), start_cpu = phases.cpu();
+    phases.enter(PhaseTimer::INITIALIZATION);
+
+    // the same runs as run_cftp (without skipping what a run shares with
+    // the previous one), so the same sample
+    StripWorkers workers(minimum_ht, maximum_ht, processes);
+    long long volume = workers.command(STRIP_RESET);
+    int time_steps = initial, steps_run = 0;
+    long long sweeps = 0;
+    while(volume) {
+        phases.enter(PhaseTimer::INITIALIZATION);
+        volume = workers.command(STRIP_RESET);
+        phases.enter(PhaseTimer::SAMPLING);
+        int power_of_two = -2;
+        for(int step=time_steps; step>0; --step) {
+            if(log2_int(step) != power_of_two) {
+                power_of_two = log2_int(step);
+                if(report)
+                    std::cerr << "Using max number of steps " << time_steps
+                        << " and difference in volume at time "
+                        << step << " is " << volume << std::endl;
+            }
+            volume += workers.command(STRIP_EVOLVE, seeds[power_of_two], step);
+            sweeps += 2;
+            if(report > 1)
+                std::cerr << "Sweep to time " << step - 1
+                          << " volume " << volume << std::endl;
+        }
+        if(report)
+            std::cerr << "Volume of difference at time 0 is "
+                      << volume << std::endl;
+        steps_run = time_steps;
         time_steps *= 2;
     }
+    phases.enter(PhaseTimer::OUTPUT);
+    if(steps_run > 0)
+        workers.gather(minimum_ht, maximum_ht);
+    workers.quit();
+    phases.enter(outer);
     if(timing) {
-        std::cerr << "Random ASM of order " << n_rows-1 << " x " << n_cols-1
+        std::cerr << "Random ASM of order " << maximum_ht.n_rows()-1
+                  << " x " << maximum_ht.n_cols()-1
                     << " generated after "
                     << time_steps / 2 << " steps." << std::endl;
-        end = std::clock();
-        double total_time = (double) (end - start)/CLOCKS_PER_SEC;
-        std::fprintf(stderr, "Elapsed time: %.4f seconds.\n", total_time);
+        std::cerr << "Sweeps of a height function: " << sweeps << "." << std::endl;
+        std::fprintf(stderr, "Elapsed time: %.4f seconds (wall), %.4f seconds of CPU"
+                     " (and %.4f in %d worker processes).\n",
+                     phases.wall() - start_wall, phases.cpu() - start_cpu,
+                     workers.cpu(), processes);
     }
+    return steps_run;
 }
@@ -4,12 +4,343 @@
 // random number generator
 typedef std::mt19937 RNG;
 
+/// @brief A height function: one contiguous 64-byte aligned buffer, each
+/// row padded to a multiple of 64 bytes (the widest SIMD register), so rows
+/// are reached by an offset instead of a pointer chase. Entries are 1, 2 or
+/// 4 byte signed ints (see ht_width). Owns its memory, which resize reuses.
+class HeightField {
+  public:
+    HeightField();
+    HeightField(const int n_rows, const int n_cols, const int width = 4);
+    HeightField(const HeightField &other);
+    HeightField(HeightField &&other) noexcept;
+    HeightField &operator=(HeightField other) noexcept;
+    ~HeightField();
+
+    /// @brief Reshapes to n_rows x n_cols with entries of width bytes,
+    /// keeping the buffer if it is big enough; the entries are zeroed,
+    /// unless the shape is unchanged, in which case this does nothing
+    void resize(const int n_rows, const int n_cols, const int width);
+
+    int n_rows() const { return n_rows_; }
+    int n_cols() const { return n_cols_; }
+    /// number of entries between the starts of two consecutive rows
+    int stride() const { return stride_; }
+    /// bytes per entry: 1 (int8_t), 2 (int16_t) or 4 (int)
+    int width() const { return width_; }
+    /// the start of row 0
+    char *data() { return data_; }
+    const char *data() const { return data_; }
+
+    /// row r as an array of T, T must have sizeof(T) == width()
+    template<typename T> T *row(const int r) {
+        return (T *) data_ + (long) r * stride_;
+    }
+    template<typename T> const T *row(const int r) const {
+        return (const T *) data_ + (long) r * stride_;
+    }
+
+    int get(const int r, const int c) const {
+        if(width_ == 1)
+            return row<int8_t>(r)[c];
+        if(width_ == 2)
+            return row<int16_t>(r)[c];
+        return row<int>(r)[c];
+    }
+    void set(const int r, const int c, const int value) {
+        if(width_ == 1)
+            row<int8_t>(r)[c] = (int8_t) value;
+        else if(width_ == 2)
+            row<int16_t>(r)[c] = (int16_t) value;
+        else
+            row<int>(r)[c] = value;
+    }
+
+  private:
+    char *data_;
+    std::size_t capacity_; // bytes allocated at data_
+    int n_rows_, n_cols_, stride_, width_;
+};
+
+/// @brief A min and a max height function in one buffer, the two heights
+/// of a site side by side (entries 2 * col and 2 * col + 1 of a row), so
+/// that a sweep updates both in a single pass over memory
+class HeightPair {
+  public:
+    HeightPair() {}
+    HeightPair(const int n_rows, const int n_cols, const int width = 4)
+        : pairs_(n_rows, 2 * n_cols, width) {}
+
+    /// @brief Reshapes to n_rows x n_cols sites, see HeightField::resize
+    void resize(const int n_rows, const int n_cols, const int width) {
+        pairs_.resize(n_rows, 2 * n_cols, width);
+    }
+
+    int n_rows() const { return pairs_.n_rows(); }
+    int n_cols() const { return pairs_.n_cols() / 2; }
+    /// bytes per entry: 1 (int8_t), 2 (int16_t) or 4 (int)
+    int width() const { return pairs_.width(); }
+
+    /// row r as an array of 2 * n_cols() T's, min and max of each site
+    template<typename T> T *row(const int r) { return pairs_.row<T>(r); }
+    template<typename T> const T *row(const int r) const {
+        return pairs_.row<T>(r);
+    }
+
+    int min(const int r, const int c) const { return pairs_.get(r, 2 * c); }
+    int max(const int r, const int c) const { return pairs_.get(r, 2 * c + 1); }
+
+    /// @brief Interleaves a min and a max height function, to this shape
+    void pack(const HeightField &minimum_ht, const HeightField &maximum_ht);
+    /// @brief Splits into a min and a max height function, to this shape
+    void unpack(HeightField &minimum_ht, HeightField &maximum_ht) const;
+
+  private:
+    HeightField pairs_;
+};
+
+/// @brief The narrowest entry width that holds heights up to max_height
+/// @param max_height the largest height (n_rows for square ASMs)
+/// @return 1 (int8_t), 2 (int16_t) or 4 (int) bytes
+int ht_width(const int max_height);
+
+/// @brief Wall (std::chrono::steady_clock) and CPU (std::clock, of all the
+/// threads of the process) time spent in each phase of sampling; the clocks
+/// are read only when the phase changes
+class PhaseTimer {
+  public:
+    /// @brief The phases: setting up and resetting the height functions,
+    /// sweeping them, comparing them (to the previous run, see run_cftp)
+    /// and writing out (the sample, checkpoints)
+    enum Phase {INITIALIZATION, SAMPLING, CHECKS, OUTPUT, N_PHASES};
+
+    /// @brief A timer in no phase, all times 0
+    PhaseTimer();
+
+    /// @brief Ends the current phase (if any) and starts phase
+    void enter(const Phase phase);
+    /// @brief Ends the current phase (if any)
+    void stop();
+    /// @brief The current phase, N_PHASES if none
+    Phase phase() const { return phase_; }
+
+    /// @brief The wall time of a phase so far, in seconds
+    double wall(const Phase phase) const;
+    /// @brief The CPU time of a phase so far, in seconds
+    double cpu(const Phase phase) const;
+    /// @brief The wall time of all the phases so far, in seconds
+    double wall() const;
+    /// @brief The CPU time of all the phases so far, in seconds
+    double cpu() const;
+
+    /// @brief The name of a phase, e.g. "sampling"
+    static const char *name(const Phase phase);
+
+  private:
+    Phase phase_;
+    std::chrono::steady_clock::time_point wall_start_;
+    std::clock_t cpu_start_;
+    double wall_[N_PHASES], cpu_[N_PHASES];
+};
+
+/// @brief A coupling from the past sampler for repeated use: owns the min
+/// and max height functions (kept between samples of the same or a smaller
+/// order), the random number generator and the seeds of the epochs
+class CftpSampler {
+  public:
+    /// @brief A sampler with its generator seeded by std::random_device
+    CftpSampler();
+    /// @brief A sampler with its generator seeded by seed
+    explicit CftpSampler(const int seed);
+
+    /// @brief Samples a random ASM with the next random seed of the generator
+    /// @param order the size for a (square) ASM
+    /// @param entries output, the order x order entries row by row
+    /// @param initial (int) number of steps to try at first, power of 2
+    /// @return the random seed of the sample (see sample_seeded)
+    int sample(const int order, int8_t *entries, const int initial = 128);
+
+    /// @brief Samples a random ASM, the same as ./rasm order -seed random_seed
+    /// @param order the size for a (square) ASM
+    /// @param random_seed the random seed of the sample
+    /// @param initial (int) number of steps to try at first, power of 2
+    /// @param report progress report, as for run_cftp
+    /// @param timer if not NULL, gets the time spent in each phase
+    /// @return the number of steps that coalesced, the sample is height()
+    int sample_seeded(const int order, const int random_seed,
+                      int initial = 128, const int report = 0,
+                      PhaseTimer *timer = NULL);
+
+    /// @brief The height function of the last sample, until the next one
+    const HeightField &height() const { return maximum_ht_; }
+
+  private:
+    HeightField minimum_ht_, maximum_ht_;
+    RNG rng_;
+    int seeds_[256];
+};
+
 /// @brief Returns a random ASM after running coupling from the past
 /// @param order the size for a (square) ASM
 /// @param initial (int) number of steps to try at first, should be power of 2
 /// @param verbose = false (default), bool for printing info to stderr
-/// @return the random sample as a matrix pointer
-int **sample_asm(const int order, int initial, const bool verbose);
+/// @return the random sample as its (order+1) x (order+1) height function,
+/// empty (0 x 0) if the order is invalid
+HeightField sample_asm(const int order, int initial, const bool verbose);
+
+/// @brief Gets the seeds of the coupling from the past epochs
+/// @param random_seed the random seed of the sample (-seed)
+/// @param seeds output, the seed of each epoch
+void cftp_seeds(const int random_seed, int seeds[256]);
+
+/// @brief The random seed of one sample of a batch
+/// @param seed the random seed of the batch
+/// @param index the index of the sample in the batch
+/// @return the seed, sampling with it as -seed gives the same ASM
+int batch_seed(const int seed, const int index);
+
+/// @brief Called with each sample of a batch as soon as it is done, by one
+/// thread at a time: the index and random seed of the sample, the number
+/// of steps it took and its height function (only valid during the call)
+typedef std::function<void(const int, const int, const int,
+                           const HeightField &)> BatchCallback;
+
+/// @brief A quantity measured on height functions: size values, which
+/// compute writes to values[0], ..., values[size - 1]
+struct Observable {
+    const char *name;
+    int size;
+    std::function<void(const HeightField &, double *)> compute;
+};
+
+/// @brief The number of -1 entries of the ASM of a height function
+Observable minus_ones_observable();
+
+/// @brief The corner sums (see print_csum) on the diagonal of height
+/// functions of the shape of matrix_ht, at (k, k) for k = 0, 1, ...
+Observable csum_diagonal_observable(const HeightField &matrix_ht);
+
+/// @brief The entries of the ASM of height functions of the shape of
+/// matrix_ht, row by row (as asm_entries)
+Observable asm_entries_observable(const HeightField &matrix_ht);
+
+/// @brief The number of -1 entries in each row of the ASM of height
+/// functions of the shape of matrix_ht
+Observable row_minus_ones_observable(const HeightField &matrix_ht);
+
+/// @brief The number of sites at each height 0, 1, ... of height
+/// functions of the shape of matrix_ht (up to the largest the boundary
+/// of initialize_ht allows)
+Observable height_histogram_observable(const HeightField &matrix_ht);
+
+/// @brief Running sums of observables over samples, for their means and
+/// standard deviations without keeping (or printing) the samples
+class Accumulator {
+  public:
+    /// @param observables what to measure on each sample
+    explicit Accumulator(const std::vector<Observable> &observables);
+
+    /// @brief Adds the observables of a sample to the sums
+    void add(const HeightField &sample);
+    /// @brief Adds the sums of another accumulator of the same observables
+    void merge(const Accumulator &other);
+
+    /// @brief What is measured
+    const std::vector<Observable> &observables() const { return observables_; }
+    /// @brief The number of samples added
+    long long count() const { return count_; }
+    /// @brief The sums of the values of observable i over the samples
+    const double *sums(const int i) const { return &sums_[offsets_[i]]; }
+    /// @brief The sums of the squares of the values of observable i
+    const double *squares(const int i) const { return &squares_[offsets_[i]]; }
+
+  private:
+    std::vector<Observable> observables_;
+    std::vector<int> offsets_;
+    std::vector<double> sums_, squares_, values_; // values_: of one sample
+    long long count_;
+};
+
+/// @brief Samples independent random ASMs on a pool of threads
+/// @param order the size for a (square) ASM
+/// @param count the number of samples
+/// @param initial (int) number of steps to try at first, should be power of 2
+/// @param seed the random seed of the batch, sample i uses batch_seed(seed, i)
+/// @param threads the number of threads, < 1 for one per core
+/// @param callback called with each sample, in the order they finish
+void sample_asm_batch(const int order, const int count, const int initial,
+                      const int seed, int threads,
+                      const BatchCallback &callback);
+
+/// @brief Samples independent random ASMs on a pool of threads
+/// @param order the size for a (square) ASM
+/// @param count the number of samples
+/// @param initial (int) number of steps to try at first, should be power of 2
+/// @param seed the random seed of the batch, sample i uses batch_seed(seed, i)
+/// @param threads the number of threads, < 1 for one per core
+/// @return the height functions of the samples, by index
+std::vector<HeightField> sample_asm_batch(const int order, const int count,
+                                          const int initial, const int seed,
+                                          const int threads);
+
+/// @brief Samples independent random ASMs on a pool of threads, into one
+/// buffer
+/// @param order the size for a (square) ASM
+/// @param count the number of samples
+/// @param initial (int) number of steps to try at first, should be power of 2
+/// @param seed the random seed of the batch, sample i uses batch_seed(seed, i)
+/// @param threads the number of threads, < 1 for one per core
+/// @param entries output, count x order x order entries, sample i at
+/// entries + i * order * order (see asm_entries)
+void sample_asm_batch(const int order, const int count, const int initial,
+                      const int seed, const int threads, int8_t *entries);
+
+/// @brief Samples independent random ASMs on a pool of threads, keeping
+/// only their statistics: each thread adds its samples to an accumulator
+/// of its own as they are done, and these are merged at the end
+/// @param order the size for a (square) ASM
+/// @param count the number of samples
+/// @param initial (int) number of steps to try at first, should be power of 2
+/// @param seed the random seed of the batch, sample i uses batch_seed(seed, i)
+/// @param threads the number of threads, < 1 for one per core
+/// @param accumulator gets the samples added
+/// @param callback if set, called with each sample (after it is added) as
+/// for the other overloads, e.g. to count the steps
+void sample_asm_batch(const int order, const int count, const int initial,
+                      const int seed, const int threads,
+                      Accumulator &accumulator,
+                      const BatchCallback &callback = BatchCallback());
+
+/// @brief The number of steps to start coupling from the past with, learned
+/// from the coalescence times recorded in a cache file (see
+/// record_coalescence): the median recorded for the order, or else the one
+/// of the nearest smaller order scaled by (order / that order)^2, rounded
+/// down to a power of two
+/// @param path the cache file
+/// @param order the size of the ASM
+/// @return the number of steps, 0 if nothing is known
+int learned_initial(const char *path, const int order);
+
+/// @brief Adds coalescence times to a cache file, which has a line
+/// "order steps count" for each order and number of steps seen. A run
+/// that started with initial steps and coalesced in its first run may
+/// have needed fewer: initial / 2 is recorded for it, so that what is
+/// learned can go down as well as up. Runs sharing the file take turns
+/// (flock on path.lock), none of their times is lost
+/// @param path the cache file, created if need be
+/// @param order the size of the ASM
+/// @param steps the number of steps of the run that coalesced
+/// @param count the number of samples that coalesced after steps
+/// @param initial the number of steps the samples started with, 0 if not
+/// known
+/// @return false if the file couldn't be written
+bool record_coalescence(const char *path, const int order, const int steps,
+                        const int count = 1, const int initial = 0);
+
+/// @brief Computes the ASM of a height function
+/// @param matrix_ht the (order+1) x (order+1) height function
+/// @param entries output, the order x order entries row by row
+void asm_entries(const HeightField &matrix_ht, int8_t *entries);
 
 /// @brief Computes the ceiling of log base 2 of x
 /// @param x an int
@@ -18,55 +349,398 @@ int **sample_asm(const int order, int initial, const bool verbose);
 int log2_int(int x);
 
 /// @brief Checks if site (row, col) in the matrix can be flipped
-/// @param matrix_ht an int matrix, the height function
+/// @param matrix_ht the height function
 /// @param row the row being checked
 /// @param col the column being checked
 /// @return true if site can be flipped
-bool is_extreme(int **matrix_ht, const int row, const int col);
+bool is_extreme(const HeightField &matrix_ht, const int row, const int col);
 
-/// @brief Initializes the minimum and maximum height functions
+/// @brief Initializes the minimum and maximum height functions of ASMs:
+/// the boundary is |row - col| + 1 (for a square, the domain wall one; for
+/// a rectangle, that of the corner sums of the partial identity matrix)
 /// @param minimum_ht the min height function
-/// @param maximum_ht the max height function
-/// @param n_rows number of rows of the height functions (same)
-/// @param n_cols number of columns of the height functions (same)
-void initialize_ht(int **minimum_ht, int **maximum_ht, 
-                   const int n_rows, const int n_cols);
+/// @param maximum_ht the max height function (same dimensions)
+void initialize_ht(HeightField &minimum_ht, HeightField &maximum_ht);
+
+/// @brief Initializes the minimum and maximum height functions with the
+/// fixed boundary (rows 0 and n_rows - 1, columns 0 and n_cols - 1) that
+/// minimum_ht has, e.g. square ice with partial domain wall boundaries: the
+/// lowest and the highest height functions with that boundary, between
+/// which all the others lie; the domain wall boundary of a square takes
+/// the fast path of initialize_ht
+/// @param minimum_ht the min height function, its boundary set
+/// @param maximum_ht the max height function (same dimensions)
+/// @throw std::invalid_argument if no height function has that boundary
+/// (neighbours on it must differ by 1, and two of its heights by at most
+/// their distance) or the heights inside don't fit in the width
+void initialize_ht_boundary(HeightField &minimum_ht, HeightField &maximum_ht);
+
+/// @brief Initializes the minimum and maximum height functions of ASMs,
+/// as initialize_ht does, side by side
+/// @param pair the min and max height functions
+void initialize_ht(HeightPair &pair);
 
 /// @brief Computes the volume difference between current min and max
 /// height functions
 /// @param minimum_ht the current min height function
-/// @param maximum_ht the current max height function
-/// @param n_rows number of rows of the height functions (same)
-/// @param n_cols number of columns of the height functions (same)
+/// @param maximum_ht the current max height function (same dimensions)
 /// @return the sum of the elements of the difference matrix
-int volume_diff(int **minimum_ht, int **maximum_ht, 
-                const int n_rows, const int n_cols);
+long long volume_diff(const HeightField &minimum_ht, const HeightField &maximum_ht);
+
+/// @brief Computes the volume difference between the min and max of a
+/// pair, in a single pass
+/// @param pair the current min and max height functions
+/// @return the sum of max - min over the sites
+long long volume_diff(const HeightPair &pair);
+
+/// @brief Philox4x32-10 counter-based generator, 128 random bits at a time
+/// @param ctr the 128 bit counter, overwritten with the random output
+/// @param seed_key the 64 bit key
+void philox4x32(uint32_t ctr[4], const uint32_t seed_key[2]);
+
+/// @brief Number of 32-bit words needed by row_coins for a row
+/// @param n_cols number of columns of the height functions
+/// @return n_cols rounded up to a multiple of 128, divided by 32
+inline int coin_words(const int n_cols) { return 4 * ((n_cols + 127) / 128); }
+
+/// @brief Computes the coin flips of every site of a row at a time step
+/// @param seed the seed of the current epoch (seeds[power_of_two])
+/// @param step the time step (counting down to 0)
+/// @param row the row of the sites
+/// @param n_cols number of columns of the height functions
+/// @param bits output, coin_words(n_cols) words; bit col%32 of word
+/// col/32 is set if site (row, col) moves up (+1) and clear if down (-1)
+void row_coins(const int seed, const long long step, const int row,
+               const int n_cols, uint32_t *bits);
+
+/// @brief Chooses the row update kernel used by evolve_ht; all kernels
+/// produce exactly the same height functions
+/// @param name "scalar", "avx2" or "auto" (the best one the CPU supports,
+/// the default)
+/// @return false if the kernel is unknown or not supported by the CPU
+bool set_evolve_kernel(const char *name);
 
-/// @brief Returns a uniformly random +1 or -1 
-/// @param rn_gen the random number generator
-/// @return +1 or -1 uniformly at random
-short random_pm1(RNG& rn_gen);
+/// @brief Returns the name of the row update kernel used by evolve_ht
+/// @return "scalar" or "avx2"
+const char *evolve_kernel_name();
+
+/// @brief The flips made by evolve_ht, chain by chain: the number of sites
+/// whose height changed (a single height function counts in both)
+struct FlipCounts {
+    long long min, max;
+};
 
 /// @brief Evolves the height function by random flips whenever possible
+/// (rows of a phase are split across threads when built with OpenMP);
+/// a single height function can be evolved by passing it as both
+/// @param minimum_ht the current min height function
+/// @param maximum_ht the current max height function (same dimensions)
+/// @param seed the seed of the current epoch
+/// @param step the current time step, together with the seed it
+/// determines all the coin flips of the sweep
+/// @param flips if not NULL, the flips of the sweep are added to it (with
+/// kernels that count them; NULL runs the ones that don't)
+/// @param first_row the row of the whole height function that row 0 of
+/// these is, when they are a strip of its rows (see run_cftp_strips): the
+/// coins and the phases of the sites are those of the whole
+/// @return the change in volume_diff(minimum_ht, maximum_ht) over the sweep
+long long evolve_ht(HeightField &minimum_ht, HeightField &maximum_ht,
+                    const int seed, const long long step,
+                    FlipCounts *flips = NULL, const int first_row = 0);
+
+/// @brief Evolves the min and max of a pair as evolve_ht does the two
+/// height functions (with the same coins, so to the same heights), with a
+/// kernel testing and flipping both heights of a site in one pass
+/// @param pair the current min and max height functions
+/// @param seed the seed of the current epoch
+/// @param step the current time step
+/// @return the change in volume_diff(pair) over the sweep
+long long evolve_ht(HeightPair &pair, const int seed, const long long step);
+
+/// @brief Evolves the height functions by sweeps steps with the same seed,
+/// step, step - 1, ..., step - sweeps + 1, exactly as that many calls of
+/// evolve_ht do. On a single thread the sweeps go down the rows together
+/// as a wavefront, so each row is brought into cache once for all of them
+/// rather than twice per sweep (the coins of a site depending on its step
+/// and not on when it is updated)
 /// @param minimum_ht the current min height function
-/// @param maximum_ht the current max height function
-/// @param n_rows number of rows of the height functions (same)
-/// @param n_cols number of columns of the height functions (same)
-/// @param rn_gen the random number generator
-void evolve_ht(int **minimum_ht, int **maximum_ht, const int n_rows, 
-               const int n_cols, RNG& rn_gen);
+/// @param maximum_ht the current max height function (same dimensions)
+/// @param seed the seed of the current epoch, for all the sweeps
+/// @param step the time step of the first sweep
+/// @param sweeps the number of sweeps
+/// @return the change in volume_diff(minimum_ht, maximum_ht) over the sweeps
+long long evolve_ht_sweeps(HeightField &minimum_ht, HeightField &maximum_ht,
+                           const int seed, const long long step,
+                           const int sweeps);
+
+/// @brief Sets the number of sweeps that run_cftp and Rocftp hand to
+/// evolve_ht_sweeps at a time (at most; epochs and checks cut them short)
+/// @param sweeps the number of sweeps, 0 for auto (see evolve_tile)
+void set_evolve_tile(const int sweeps);
+
+/// @brief The number of sweeps to hand to evolve_ht_sweeps at a time for
+/// height functions of this size: as set by set_evolve_tile, or else 1
+/// when a min and a max fit in the L2 cache (or OpenMP has several
+/// threads), 8 when they don't
+/// @param matrix_ht a height function of the size
+int evolve_tile(const HeightField &matrix_ht);
+
+/// @brief Chooses how run_cftp keeps the min and max while it evolves both:
+/// as two height functions swept by evolve_ht_sweeps, or side by side in a
+/// HeightPair swept by evolve_ht one sweep at a time (not with a telemetry
+/// or a trajectory, which look at every sweep); both give exactly the same
+/// samples
+/// @param name "separate" (the default) or "pair"
+/// @return false if the layout is unknown
+bool set_evolve_layout(const char *name);
+
+/// @brief Returns the layout used by run_cftp
+/// @return "separate" or "pair"
+const char *evolve_layout_name();
+
+/// @brief Wilson's read-once coupling from the past: one chain run forward
+/// in blocks of a fixed number of steps, each with fresh coins, and a block
+/// coalesces if it takes the min and max to the same height function; the
+/// states just before the coalescing blocks (after the first) are
+/// independent exact samples. Nothing is replayed, so no seed table.
+class Rocftp {
+  public:
+    /// @brief A chain for ASMs of the given order
+    /// @param order the size for a (square) ASM
+    /// @param random_seed determines the coins of every block
+    /// @param block the number of steps of a block, best about the time it
+    /// takes to coalesce (so that a block coalesces about half the time)
+    /// @param width bytes per height entry, 0 for ht_width of the order
+    /// @param report progress report, 1 for a line per block
+    Rocftp(const int order, const int random_seed, const int block,
+           const int width = 0, const int report = 0);
+
+    /// @brief Runs the chain to its next sample
+    /// @param sample output, the height function of the sample
+    /// @return the number of sweeps of a single height function it took
+    long long next(HeightField &sample);
+
+  private:
+    /// the seed of the coins of a block
+    int block_seed(const long long index) const;
+
+    HeightField minimum_ht_, maximum_ht_, state_;
+    long long initial_volume_, block_index_;
+    int random_seed_, block_, report_;
+    bool started_; // a block has coalesced, state_ is being followed
+};
+
+/// @brief Where run_cftp is, enough to carry on from there
+struct CftpProgress {
+    int time_steps; // the number of steps of the current run
+    int step; // the next step to sweep, counting down to 1 (0: run done)
+    long long volume; // volume_diff of the height functions now
+    long long initial_volume; // volume_diff at the start of every run
+};
+
+/// @brief Periodic checkpoints of run_cftp, in a memory-mapped file with
+/// two slots written in turn (so a crash while writing one leaves the
+/// other); saving copies the state to memory and doesn't wait on the disk
+class Checkpoint {
+  public:
+    /// @brief Opens (or creates) the checkpoint file
+    /// @param path the checkpoint file
+    /// @param shape a height function of the size being sampled
+    /// @param random_seed the random seed of the sample, kept with it
+    /// @param every the number of seconds between checkpoints
+    Checkpoint(const char *path, const HeightField &shape,
+               const int random_seed, const double every);
+    ~Checkpoint();
+    Checkpoint(const Checkpoint &) = delete;
+    Checkpoint &operator=(const Checkpoint &) = delete;
+
+    /// @brief Whether every seconds have gone by since the last save
+    bool due() const;
+
+    /// @brief Saves the state of run_cftp (see CftpProgress)
+    void save(const int seeds[256], const int time_steps, const int step,
+              const long long volume, const long long initial_volume,
+              const HeightField &minimum_ht, const HeightField &maximum_ht);
+
+  private:
+    unsigned char *map_;
+    std::size_t bytes_, slot_bytes_;
+    uint64_t sequence_; // of the last save, its slot is sequence_ % 2
+    int random_seed_;
+    double every_;
+    std::chrono::steady_clock::time_point last_save_;
+};
+
+/// @brief Reads the last complete checkpoint of a file
+/// @param path the checkpoint file
+/// @param random_seed output, the random seed of the sample
+/// @param seeds output, the seeds of the epochs
+/// @param progress output, where run_cftp was
+/// @param minimum_ht output, the min height function (resized)
+/// @param maximum_ht output, the max height function (resized)
+/// @return false if there is no complete checkpoint in the file
+bool load_checkpoint(const char *path, int &random_seed, int seeds[256],
+                     CftpProgress &progress, HeightField &minimum_ht,
+                     HeightField &maximum_ht);
+
+/// @brief Telemetry of run_cftp as JSON lines written to a file descriptor:
+/// an "epoch" line at the end of every epoch and a "progress" line every so
+/// often, with the sweeps, the flips of each chain, the wall and CPU time
+/// and the sweeps per second since the previous line of the kind, and the
+/// volume and fraction of coalesced sites then; a "run" line at the end of
+/// every run. Without telemetry run_cftp counts none of this.
+class Telemetry {
+  public:
+    /// @param fd where the lines go, left open
+    /// @param every the seconds between progress lines, 0 for every sweep
+    Telemetry(const int fd, const double every);
+
+    /// @brief Counts a sweep of run_cftp
+    /// @param sweeps the number of height functions swept, 1 or 2
+    /// @param min_flips the flips of the min (0 if not swept)
+    /// @param max_flips the flips of the max (0 if not swept)
+    void sweep(const int sweeps, const long long min_flips,
+               const long long max_flips);
+
+    /// @brief Whether every seconds have gone by since the last progress line
+    bool due() const;
+
+    /// @brief Writes a progress line
+    /// @param time_steps the number of steps of the run
+    /// @param step the next step to sweep
+    /// @param volume volume_diff of the height functions
+    /// @param minimum_ht the min height function, NULL if not up to date
+    /// (then neither is the volume, and both are written as null)
+    /// @param maximum_ht the max height function
+    void progress(const int time_steps, const int step, const long long volume,
+                  const HeightField *minimum_ht, const HeightField *maximum_ht);
+
+    /// @brief Writes the line of an epoch that ended, as for progress
+    /// @param epoch the epoch, log2_int of its steps
+    void epoch(const int time_steps, const int epoch, const int step,
+               const long long volume, const HeightField *minimum_ht,
+               const HeightField *maximum_ht);
+
+    /// @brief Writes the line of a run that ended
+    /// @param coalesced whether the min and max met
+    void run(const int time_steps, const long long volume, const bool coalesced);
+
+  private:
+    /// sweeps, flips and the clocks since the previous line of a kind
+    struct Tally {
+        long long sweeps, min_flips, max_flips;
+        std::chrono::steady_clock::time_point wall;
+        std::clock_t cpu;
+        void reset();
+    };
+    void write_line(const char *event, const Tally &tally, const int time_steps,
+                    const int epoch, const int step, const long long volume,
+                    const HeightField *minimum_ht, const HeightField *maximum_ht);
+
+    int fd_;
+    double every_;
+    Tally epoch_, progress_, total_;
+};
+
+/// @brief Observables of the max chain of run_cftp after each of the last
+/// sweeps of every run, recorded as it goes, with the volume of max - min
+/// then. Once run_cftp returns they are those of the run that coalesced:
+/// where the volume is 0 the min and max have met, and the values are
+/// those of the sample's own trajectory up to time 0 (each state of it an
+/// exact sample, the same coins having taken every start there), without
+/// sampling again
+class Trajectory {
+  public:
+    /// @param sweeps the number of last sweeps, of times -sweeps + 1 to 0
+    /// @param observables what to measure after each
+    Trajectory(const int sweeps, const std::vector<Observable> &observables);
+
+    /// @brief The number of last sweeps recorded
+    int sweeps() const { return sweeps_; }
+    /// @brief What is measured
+    const std::vector<Observable> &observables() const { return observables_; }
+    /// @brief The number of times of the last run, min(sweeps, its steps)
+    int times() const { return times_; }
+
+    /// @brief The values of observable i at time -t, 0 <= t < times()
+    const double *values(const int t, const int i) const {
+        return &values_[(std::size_t) t * stride_ + offsets_[i]];
+    }
+    /// @brief volume_diff at time -t, -1 if not recorded (a resumed run
+    /// started after it)
+    long long volume(const int t) const { return volumes_[t]; }
+
+    /// @brief Starts recording a run
+    /// @param time_steps the number of steps of the run
+    void start(const int time_steps);
+    /// @brief Records the time -t of the run
+    /// @param t the number of steps before time 0
+    /// @param volume volume_diff of the height functions
+    /// @param maximum_ht the max height function
+    void record(const int t, const long long volume,
+                const HeightField &maximum_ht);
+
+  private:
+    int sweeps_, times_, stride_; // stride_: the values of all at a time
+    std::vector<Observable> observables_;
+    std::vector<int> offsets_;
+    std::vector<double> values_;
+    std::vector<long long> volumes_;
+};
 
 /// @brief Runs the coupling from the past main loop
-/// @param minimum_ht the min height function
-/// @param maximum_ht the max height function
-/// @param n_rows number of rows of the height functions (same)
-/// @param n_cols number of columns of the height functions (same)
-/// @param rn_gen the random number generator
+/// @param minimum_ht the min height function, every restart resets it and
+/// the max with initialize_ht_boundary, so any boundary goes
+/// @param maximum_ht the max height function (same dimensions)
+/// @param seeds the seeds array for reseeding at each critical point
+/// @param initial the number of initial steps to run the initial loop for
+/// @param report progress report: 0 none, 1 at every epoch and restart,
+/// 2 also after every sweep
+/// @param timing a bool for printing the elapsed (wall and CPU) time
+/// @param checkpoint if not NULL, where to save the state whenever it is
+/// due, and once done
+/// @param resume if not NULL, carry on from there (the height functions
+/// being those of the checkpoint) instead of starting over
+/// @param telemetry if not NULL, where to write the telemetry
+/// @param timer if not NULL, gets the time spent in each phase (and is
+/// left in the phase it was in)
+/// @param trajectory if not NULL, where to record the last sweeps of each
+/// run (both chains are then evolved over these, rather than taking one
+/// from the previous run)
+/// @return the number of steps of the run that coalesced (0 if min and max
+/// were equal to begin with)
+int run_cftp(HeightField &minimum_ht, HeightField &maximum_ht,
+             const int seeds[256], const int initial, const int report,
+             const bool timing, Checkpoint *checkpoint = NULL,
+             const CftpProgress *resume = NULL, Telemetry *telemetry = NULL,
+             PhaseTimer *timer = NULL, Trajectory *trajectory = NULL);
+
+/// @brief Runs coupling from the past as run_cftp does, with the rows of
+/// the height functions split into strips, one per worker process (forked,
+/// all on this host). The workers exchange the two rows on either side of
+/// their strips after every sweep through shared memory, and the volume is
+/// the sum of theirs. The coins being those of the whole, the sample is
+/// the one run_cftp gives with the same seeds. Call it before anything
+/// has used OpenMP in the process, which doesn't survive a fork (the
+/// workers then each use OMP_NUM_THREADS threads). If a worker dies the
+/// others are killed and std::runtime_error is thrown.
+/// @param minimum_ht the min height function, every restart resets it and
+/// the max to what they are at the start
+/// @param maximum_ht the max height function (same dimensions)
 /// @param seeds the seeds array for reseeding at each critical point
 /// @param initial the number of initial steps to run the initial loop for
-/// @param report a bool for verbose progress report
-void run_cftp(int **minimum_ht, int **maximum_ht, const int n_rows, 
-              const int n_cols, RNG& rn_gen, const int seeds[256],
-              const int initial, const bool report, const bool timing);
+/// @param report progress report, as for run_cftp
+/// @param timing a bool for printing the elapsed time (with the CPU time
+/// of the workers)
+/// @param processes the number of worker processes
+/// @param timer if not NULL, gets the time spent in each phase
+/// @return the number of steps of the run that coalesced (0 if min and max
+/// were equal to begin with)
+/// @throw std::invalid_argument if there are fewer than 2 rows per process,
+/// std::runtime_error if the workers can't be started
+int run_cftp_strips(HeightField &minimum_ht, HeightField &maximum_ht,
+                    const int seeds[256], const int initial, const int report,
+                    const bool timing, const int processes,
+                    PhaseTimer *timer = NULL);
 
 #endif
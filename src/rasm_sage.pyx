@@ -1,11 +1,87 @@
 # distutils: language = c++
 
-from libc.stdlib cimport malloc, free
 from libcpp cimport bool
+from libcpp.utility cimport move
+from libcpp.vector cimport vector
+from libc.stdint cimport int8_t
+from cpython.buffer cimport PyBUF_FORMAT, PyBUF_STRIDES, PyBUF_ND
+import os
+import numpy as np
 
 # import C++ sampling routine
 cdef extern from "rasm_lib.cpp":
-    int** sample_asm(int order, int initial, bool verbose)
+    # the height function, owns its memory (freed by its destructor)
+    cdef cppclass HeightField:
+        HeightField()
+        HeightField(int n_rows, int n_cols, int width) except +
+        int n_rows()
+        int n_cols()
+        int stride()
+        int width()
+        char *data()
+        int get(int r, int c)
+    # all of these are thread safe and are called without the GIL
+    HeightField sample_asm(int order, int initial, bool verbose) except + nogil
+    void asm_entries(const HeightField &matrix_ht, int8_t *entries) nogil
+    void sample_asm_batch(int order, int count, int initial, int seed,
+                          int threads, int8_t *entries) except + nogil
+    # running sums of observables of the samples
+    cdef cppclass Observable:
+        int size
+    Observable asm_entries_observable(const HeightField &matrix_ht)
+    Observable row_minus_ones_observable(const HeightField &matrix_ht)
+    Observable height_histogram_observable(const HeightField &matrix_ht)
+    cdef cppclass Accumulator:
+        Accumulator(const vector[Observable] &observables) except +
+        long long count()
+        const double *sums(int i)
+        const double *squares(int i)
+    void sample_asm_batch(int order, int count, int initial, int seed,
+                          int threads, Accumulator &accumulator) except + nogil
+    # a sampler for repeated use, one thread at a time
+    cdef cppclass CftpSampler:
+        CftpSampler() except +
+        CftpSampler(int seed) except +
+        int sample(int order, int8_t *entries, int initial) except + nogil
+
+cdef class HeightBuffer:
+    """
+    Owns a sampled height function and exposes its rows, in place, through
+    the buffer protocol; numpy.asarray() of it is a view that keeps it alive
+    """
+    cdef HeightField ht
+    cdef Py_ssize_t shape[2]
+    cdef Py_ssize_t strides[2]
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        # rows are padded, so the buffer is strided
+        if (flags & PyBUF_STRIDES) != PyBUF_STRIDES:
+            raise BufferError("the height function is a strided buffer")
+        self.shape[0] = self.ht.n_rows()
+        self.shape[1] = self.ht.n_cols()
+        self.strides[0] = <Py_ssize_t> self.ht.stride() * self.ht.width()
+        self.strides[1] = self.ht.width()
+        buffer.buf = self.ht.data()
+        buffer.obj = self
+        buffer.len = self.shape[0] * self.strides[0]
+        buffer.itemsize = self.ht.width()
+        buffer.readonly = 0
+        buffer.ndim = 2
+        buffer.shape = self.shape
+        buffer.strides = self.strides
+        buffer.suboffsets = NULL
+        buffer.internal = NULL
+        buffer.format = NULL
+        if flags & PyBUF_FORMAT:
+            if self.ht.width() == 1:
+                buffer.format = "b"
+            elif self.ht.width() == 2:
+                buffer.format = "h"
+            else:
+                buffer.format = "i"
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        pass
 
 def ht_to_asm(ht_fn):
     """
@@ -38,33 +114,222 @@ cpdef rasm(order, initial=128, verbose=False):
                      time taken, etc.
 
     Returns: 
-    list[list[int]] -- the alternating sign matrix, order x order
+    numpy.ndarray -- the alternating sign matrix, order x order, int8
+    """
+
+    # declare height fn, do the sampling without holding the GIL, so
+    # that Python threads can sample at the same time
+    # (if ASM is order x order, height function is (order+1) x (order+1))
+    cdef HeightField ht_fn
+    cdef int c_order = order, c_initial = initial
+    cdef bool c_verbose = verbose
+    with nogil:
+        ht_fn = sample_asm(c_order, c_initial, c_verbose)
+    if ht_fn.n_rows() == 0:
+        raise ValueError(f"invalid order {order}")
+
+    # the ASM is computed in C++, straight into the numpy array
+    asm = np.empty((order, order), dtype=np.int8)
+    cdef int8_t[:, ::1] entries = asm
+    asm_entries(ht_fn, &entries[0, 0])
+    return asm
+
+cpdef rasm_height(order, initial=128, verbose=False):
+    """
+    Samples a random alternating sign matrix of square size given by order,
+    and returns its height function without copying it
+
+    Inputs: as for rasm
+
+    Returns:
+    numpy.ndarray -- the height function, (order+1) x (order+1), a view of
+                     the C++ buffer (int8, int16 or int32 depending on the
+                     order), which is freed along with the array
+    """
+    cdef HeightBuffer owner = HeightBuffer()
+    cdef int c_order = order, c_initial = initial
+    cdef bool c_verbose = verbose
+    with nogil:
+        owner.ht = move(sample_asm(c_order, c_initial, c_verbose))
+    if owner.ht.n_rows() == 0:
+        raise ValueError(f"invalid order {order}")
+    return np.asarray(owner)
+
+cdef class Sampler:
+    """
+    Samples random alternating sign matrices over and over, reusing its
+    buffers and random number generator from one call to the next (use one
+    Sampler per thread)
+    """
+    cdef CftpSampler *sampler
+
+    def __cinit__(self, seed=None):
+        """
+        Inputs:
+        seed: int -- seeds the random numbers of the samples (random if None)
+        """
+        if seed is None:
+            self.sampler = new CftpSampler()
+        else:
+            self.sampler = new CftpSampler(<int> seed)
+
+    def __dealloc__(self):
+        del self.sampler
+
+    def sample(self, order, out=None, initial=128):
+        """
+        Samples a random alternating sign matrix of square size given by order
+
+        Inputs:
+        order: int          -- the size of the desired ASM
+        out: numpy.ndarray  -- where to write the ASM, order x order, int8
+                               and C contiguous (a new array if None)
+        initial: int        -- the initial number of steps for CFTP
+
+        Returns:
+        numpy.ndarray -- out, holding the alternating sign matrix
+        """
+        if order < 1:
+            raise ValueError(f"invalid order {order}")
+        if out is None:
+            out = np.empty((order, order), dtype=np.int8)
+        if out.shape != (order, order):
+            raise ValueError(f"out must be {order} x {order}")
+        cdef int8_t[:, ::1] entries = out
+        cdef int c_order = order, c_initial = initial
+        with nogil:
+            self.sampler.sample(c_order, &entries[0, 0], c_initial)
+        return out
+
+cpdef rasm_batch(order, count, threads=0, seed=None, initial=128):
+    """
+    Samples independent random alternating sign matrices in parallel, on a
+    pool of C++ threads, without holding the GIL
+
+    Inputs:
+    order: int    -- the size of the desired ASMs
+    count: int    -- the number of ASMs
+    threads: int  -- the number of threads, 0 for one per core
+    seed: int     -- the random seed of the batch (random if None); the
+                     same seed gives the same batch, and sample i is the
+                     one ./rasm order -count ... -seed seed prints as i
+    initial: int  -- the initial number of steps to start with for CFTP
+
+    Returns:
+    numpy.ndarray -- the ASMs, count x order x order, int8
     """
+    if order < 1:
+        raise ValueError(f"invalid order {order}")
+    if count < 1:
+        raise ValueError(f"invalid count {count}")
+    if seed is None:
+        seed = int.from_bytes(os.urandom(4), "little", signed=True)
 
-    # declare height function, allocate memory    
-    # needed (I think) in case new and delete are used on the CPP side
-    # if ASM is order x order, height function is (order+1) x (order+1)
-    # cdef int ** ht_fn = <int **> malloc((order+1) * sizeof(int*))
-    # cdef int i
-    # for i in range(order+1):
-    #     ht_fn[i] = <int *> malloc((order+1) * sizeof(int));
+    asms = np.empty((count, order, order), dtype=np.int8)
+    cdef int8_t[:, :, ::1] entries = asms
+    cdef int c_order = order, c_count = count, c_initial = initial
+    cdef int c_seed = seed, c_threads = threads
+    with nogil:
+        sample_asm_batch(c_order, c_count, c_initial, c_seed, c_threads,
+                         &entries[0, 0, 0])
+    return asms
 
-    # declare height fn, do the sampling
-    cdef int ** ht_fn = sample_asm(order, initial, verbose)
+def rasm_batch_stats(order, count, threads=0, seed=None, initial=128):
+    """
+    Samples independent random alternating sign matrices as rasm_batch
+    does, keeping only their statistics (./rasm order -count count -stats)
+
+    Inputs: as for rasm_batch
+
+    Returns:
+    dict -- the numpy.ndarrays (float64) "asm_entries" (order x order),
+            "row_minus_ones" (the -1 entries of each row, order) and
+            "height_histogram" (the sites at each height 0, 1, ...,
+            order + 1) of the means over the samples, and the same with
+            "_sd" for their standard deviations
+    """
+    if order < 1:
+        raise ValueError(f"invalid order {order}")
+    if count < 1:
+        raise ValueError(f"invalid count {count}")
+    if seed is None:
+        seed = int.from_bytes(os.urandom(4), "little", signed=True)
 
-    # save answer in Python object
-    height = [[0 for __ in range(order+1)] for _ in range(order+1)]
-    for i in range(order+1):
-        for j in range(order+1):
-            height[i][j] = ht_fn[i][j]
+    cdef HeightField shape = HeightField(order + 1, order + 1, 4)
+    cdef vector[Observable] observables
+    observables.push_back(asm_entries_observable(shape))
+    observables.push_back(row_minus_ones_observable(shape))
+    observables.push_back(height_histogram_observable(shape))
+    cdef Accumulator *stats = new Accumulator(observables)
+    cdef int c_order = order, c_count = count, c_initial = initial
+    cdef int c_seed = seed, c_threads = threads
+    try:
+        with nogil:
+            sample_asm_batch(c_order, c_count, c_initial, c_seed, c_threads,
+                             stats[0])
+        result = {}
+        names = ["asm_entries", "row_minus_ones", "height_histogram"]
+        for i in range(3):
+            size = observables[i].size
+            sums = np.array(<double[:size]> stats.sums(i))
+            squares = np.array(<double[:size]> stats.squares(i))
+            mean = sums / count
+            sd = (np.sqrt(np.maximum(squares - sums * mean, 0) / (count - 1))
+                  if count > 1 else np.zeros(size))
+            if i == 0:
+                mean, sd = mean.reshape(order, order), sd.reshape(order, order)
+            result[names[i]] = mean
+            result[names[i] + "_sd"] = sd
+        return result
+    finally:
+        del stats
 
-    # deallocate memory (note ht_fn is +1 per dim bigger than the ASM)
-    for i in range(order+1):
-        free(ht_fn[i]);
-    free(ht_fn);
+def load_bin(data):
+    """
+    Loads the records written by ./rasm -format bin (see write_bin in rasm.h)
+
+    Input:
+    data: bytes   -- the contents of the output, e.g. open(...).read()
 
-    # done, return ASM
-    return ht_to_asm(height)
+    Returns:
+    list[(dict, numpy.ndarray)] -- for each record its header (kind, order,
+                     index, seed, steps) and the ASM (order x order, int8)
+                     or height function ((order+1) x (order+1), int32)
+    """
+    buf = np.frombuffer(data, dtype=np.uint8)
+    header = np.dtype([("magic", "S4"), ("version", "u1"), ("kind", "u1"),
+                       ("reserved", "<u2"), ("order", "<i4"), ("index", "<i4"),
+                       ("seed", "<i4"), ("origin", "<i4"), ("steps", "<i8")])
+    records = []
+    pos = 0
+    while pos < len(buf):
+        h = np.frombuffer(data, dtype=header, count=1, offset=pos)[0]
+        if h["magic"] != b"RASM" or h["version"] != 1:
+            raise ValueError(f"not a rasm binary record at byte {pos}")
+        n = int(h["order"])
+        pos += header.itemsize
+        if h["kind"] == 0:
+            # 2 bits per entry, 4 entries per byte, 3 stands for -1
+            size = (n * n + 3) // 4
+            codes = (buf[pos:pos+size, None] >> np.array([0, 2, 4, 6], np.uint8)) & 3
+            matrix = codes.reshape(-1)[:n*n].astype(np.int8).reshape(n, n)
+            matrix[matrix == 3] = -1
+        else:
+            # one bit per entry for a +1 or -1 step, rows padded to bytes
+            row_bytes = (n + 8) // 8
+            size = (n + 1) * row_bytes
+            bits = np.unpackbits(buf[pos:pos+size].reshape(n + 1, row_bytes),
+                                 axis=1, bitorder="little")[:, :n+1]
+            steps = 2 * bits.astype(np.int32) - 1
+            steps[0, 0] = h["origin"]
+            matrix = np.cumsum(steps, axis=1, dtype=np.int32)
+            matrix += (np.cumsum(steps[:, 0]) - steps[:, 0])[:, None]
+        pos += size
+        records.append(({"kind": "asm" if h["kind"] == 0 else "height",
+                         "order": n, "index": int(h["index"]),
+                         "seed": int(h["seed"]), "steps": int(h["steps"])},
+                         matrix))
+    return records
 
 def pprint_asm(asm, symbols=""):
     """